@@ -23,10 +23,9 @@ uint8_t csense=1;               /* Cassette sense toggle */
                                 /* separate buttons for a virtual cassette */
                                 /* deck, so motor and sense are not always */
                                 /* the same. */
-uint8_t vblank=0;               /* /VBLANK signal */
-uint8_t vgate;                  /* /VGATE signal  - not used */
+volatile uint8_t vgate;         /* /VGATE signal - 1 blanks the display */
 
-static uint8_t cblink=0;        /* Cursor blink (<= 0x7F off, > 0x7F on) */
+volatile uint8_t cblink=0;      /* Cursor blink (<= 0x7F off, > 0x7F on) */
 
 #ifdef USBDIAGOUTPUT
   uint8_t scantimes=1;          /* How many times the keyboard matrix is */
@@ -127,12 +126,11 @@ void wr8255(uint16_t addr, uint8_t data)
                                       // statement simpler
            switch (portCbit) {
              case 0: // /VGATE
-                     // The code using this flag in vgadisplay.c was removed 
-                     // after release 1.2.2. It makes no difference to the
-                     // emulator, unlike the original hardware.
-                     // If /VGATE is used too frequently it exceeds the
-                     // capability of the pico and pico2 to generate a stable
-                     // VGA display, resulting in screen corruption.
+                     // vgadisplay.c samples this flag once per scanline and
+                     // outputs a single solid colour run for blanked lines.
+                     // Frequent toggling therefore costs nothing extra on
+                     // core 1, so the VGA signal remains stable (unlike
+                     // the implementation removed after release 1.2.2).
                      if (setbit) {
                        portC|=0x01;
                        vgate=0;      // Signal to unblank screen
@@ -239,8 +237,9 @@ uint8_t rd8255(uint16_t addr)
            retval|=(cmotor?0x10:0x00); // Cassette motor (off=0x00,on=0x10)
            retval|=(cread()?0x20:0x00);// Next bit read from tape  (1=0x20)
                                        //                          (0=0x00)
-           retval|=((cblink>0x7F)?0x40:0x00); // Blink cursor
-           retval|=(vblank?0x80:0x00);        // /V-BLANK status
+           retval|=(((vgalatch?cblinklatch:cblink)>0x7F)?0x40:0x00);
+                                              // Blink cursor
+           retval|=(mzvblank(NULL)?0x80:0x00);// /V-BLANK status
            break;
     default:// Error!
            retval=0xC7;
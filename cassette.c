@@ -2,6 +2,9 @@
 /* Tim Holyoake, August-October 2024 */
 
 #include "picomz.h"
+#include "mzt.h"
+#include "mzc.h"
+#include "mzf.h"
 
 #define LONGPULSE  1     /* cread() returns high for a long pulse */
 #define SHORTPULSE 0     /*                 low for a short pulse */
@@ -10,6 +13,8 @@
                          /* write a pulse is treated as a 1 rather than  */
                          /* than a 0. The real MZ-80K read point is      */
                          /* after 368us, but 400 is safe in the emulator */
+#define CPUMHZ   2       /* MZ-80K Z80 clock speed in MHz                */
+#define READPT_T (READPT*CPUMHZ) /* READPT in Z80 T-states               */
 
 #define RBGAP_L 120      /* Big tape gap length in bits - read  */
 #define WBGAP_L 22000    /* Big tape gap length in bits - write */
@@ -26,6 +31,67 @@
                          /* calculation is in the comment below */
 //(L_L+S256_L+HDR_L+(HDR_L/8)+CHK_L+(CHK_L/8)+L_L+WSGAP_L+STM_L+L_L)*2 
 
+/* Tape body window */
+#define TAPEBUFSIZE 512  /* Bytes in each half of the tape body window -  */
+                         /* one sd card sector                            */
+#define TAPESTAGESIZE (4*TAPEBUFSIZE) /* Bytes of a SAVE gathered to go  */
+                         /* to the card as one multi-block write          */
+
+#define TAPECLOSED  0    /* No tape file open                             */
+#define TAPEREAD    1    /* tapefp is the preloaded tape, ready for LOAD  */
+#define TAPEWRITE   2    /* tapefp is a tape being written by SAVE        */
+#define TAPECLOSING 3    /* tapefp is a finished SAVE, waiting for the sd */
+                         /* card worker to close it                       */
+
+/* Kinds of step in the cread() tape program */
+#define TSHORT      0    /* Short pulses                                  */
+#define TLONG       1    /* Long pulses                                   */
+#define THEADER     2    /* Tape header bytes                             */
+#define THCHK       3    /* Header checksum bytes                         */
+#define TBODY       4    /* Tape body bytes - length is in the header     */
+#define TBCHK       5    /* Body checksum bytes                           */
+#define TEND        6    /* Final long pulse, then stop                   */
+
+/* Fast seek cluster link map for the preloaded tape - 2 entries for */
+/* each fragment of the file, plus 2. A contiguous file needs 4.     */
+#define TAPECLMTSIZE 32
+
+/* Tape directory index */
+#define TAPEINDEXMAX 512 /* Maximum number of files in the tape index     */
+#define TAPEDIRMAX   128 /* Longest path of the directory being browsed   */
+
+/* Tape catalogue, shown in the emulator status area */
+#define TAPECATROWS  4   /* Rows of entries - status lines 1 to 4         */
+#define TAPECATPAGE  (TAPECATROWS*2) /* Entries on a page - two columns   */
+#define TAPECATFIND  17  /* Longest name that can be typed                */
+
+/* Flash tape library - a .mzt container image written to spare flash,   */
+/* read in place through XIP when there is no sd card. The offset can be */
+/* changed with a compile definition if the emulator grows into it.      */
+#ifndef TAPEFLASHOFFSET
+#define TAPEFLASHOFFSET 0x100000 /* 1 Mbyte into flash                 */
+#endif
+#define TAPEFLASHSIZE (PICO_FLASH_SIZE_BYTES-TAPEFLASHOFFSET)
+#define TAPEFLASH     ((const uint8_t *)(XIP_BASE+TAPEFLASHOFFSET))
+
+/* RAM cache of tapes read from the sd card - RP2350 only */
+#ifdef PICO2
+#define TAPECACHESIZE (160*1024) /* Bytes of tape images cached         */
+#define TAPECACHEMAX  16         /* Most tapes cached                   */
+#endif
+
+#define DUMPSLICE   (4*FF_MAX_SS) /* Bytes of a memory dump written at a */
+                                  /* time - one multi-block write        */
+
+/* Memory dump file - a 'tape' header, then mzuserram, mzvram, the z80 */
+/* state and the 8253 state                                            */
+#define DUMPFILE    "MZDUMP.MZF"
+#define DUMPURAM    TAPEHEADERSIZE
+#define DUMPVRAM    (DUMPURAM+URAMSIZE)
+#define DUMPCPU     (DUMPVRAM+VRAMSIZE)
+#define DUMPPIT     (DUMPCPU+sizeof(z80))
+#define DUMPSIZE    (DUMPPIT+sizeof(pit8253))
+
 /* Used in mzspinny() */
 #define TCOUNTERMAX 999  /* Maximum value of tapecounter */
 #define TCOUNTERINC 200  /* Incr. tapecounter by 1 every TCOUNTERINC calls */
@@ -34,10 +100,168 @@ uint8_t crstate=0;       // Holds tape state for cread()
 uint8_t cwstate=0;       // Holds tape state for cwrite()
 
 uint8_t header[TAPEHEADERSIZE];// Tape headers are always 128 bytes
-uint8_t body[TAPEBODYMAXSIZE]; // Maximum storage is 47.5K - 48640 bytes
 
 static FATFS fs;         // File system pointer for sd card
 
+// The tape body is never held in memory as a whole. It is streamed to
+// and from the sd card through a window of two TAPEBUFSIZE byte halves.
+// While cread() sends the bits of one half, the other holds the next
+// part of the body. Likewise, cwrite() fills one half while the other
+// is written to the sd card - gathered in tapestage first, so the card
+// gets TAPESTAGESIZE bytes at a time as one multi-block write. The
+// window is lined up with the sectors of the .mzf file, header included,
+// so every read and write is of whole sd card sectors - FatFs never has
+// to read a sector to update part of it.
+static uint8_t tapebuf[2][TAPEBUFSIZE]; // Tape body window
+static uint8_t tapestage[TAPESTAGESIZE];// Window halves of a SAVE not yet
+static uint16_t tapestagelen;           // written, and how many bytes
+#define TAPEBUFBYTE(n) tapebuf[(((n)+TAPEHEADERSIZE)/TAPEBUFSIZE)&1] \
+                              [((n)+TAPEHEADERSIZE)%TAPEBUFSIZE]
+static FIL tapefp;                      // Preloaded tape or tape being saved
+static DWORD tapeclmt[TAPECLMTSIZE];    // Cluster link map for tapefp
+static uint8_t tapemode=TAPECLOSED;     // What tapefp is being used for
+static uint8_t tapewname[22];           // Name of the tape being saved
+static uint16_t tapebodylen;            // Body length of the tape being read
+static uint32_t tapebase;               // File offset of the tape header
+static bool tapepacked;                 // Preloaded tape is compressed
+static uint32_t tapebufpos;             // Offset from tapebase of the next
+                                        // window read
+static const uint8_t *tapeimage=NULL;   // Preloaded tape in flash, read
+                                        // in place rather than through
+                                        // the window
+static uint16_t tapehchk;               // Header checksum, set at preload
+static uint16_t tapebchk;               // Body checksum, summed as the
+                                        // window is filled
+static uint16_t tapeimagebchk;          // Body checksum of tapeimage,
+                                        // worked out at preload
+
+// A compressed tape body is decompressed into the window as it is read,
+// from tapein - which holds up to one sector of the compressed file - so
+// memory use is the same whatever the size of the tape.
+static mzcstate tapeunz;                // Decompressor state
+static uint8_t tapein[TAPEBUFSIZE];     // Compressed bytes read
+static uint tapeinlen,tapeinpos;        // Bytes in tapein, bytes used
+static uint32_t tapeunpacked;           // Bytes of the tape image made
+
+#ifdef PICO2
+// Whole images of the tapes read most recently are kept in tapecache, so
+// selecting one of them again is a pointer swap rather than a trip to the
+// sd card - it is read in place, like a tape in the flash library. A tape
+// is copied into the cache as cread() sends it, so it costs no extra sd
+// card reads, and only becomes usable once it has all been sent. Images
+// are never moved once copied in - a new one goes in the first gap big
+// enough for it, and the least recently preloaded ones are removed until
+// there is one.
+typedef struct tapecacheentry {
+  uint8_t  sfn[FF_SFN_BUF+1]; // File the tape was read from - "" if stale
+  uint32_t offset;            // Offset of the tape header in the file
+  uint32_t sclust;            // First cluster - tells apart files with
+                              // the same name in different directories
+  uint32_t fsize;             // File size and modification date and
+  uint16_t fdate,ftime;       // time, so a changed file isn't matched
+  uint32_t start;             // Offset of the image in tapecache
+  uint32_t size;              // Image size - header and body
+  uint32_t used;              // Stamp of the last preload
+  bool     valid;             // Whole image has been copied in
+} tapecacheentry;
+
+static uint8_t tapecache[TAPECACHESIZE];         // Tape images
+static tapecacheentry tapecacheent[TAPECACHEMAX]; // In tapecache order
+static uint8_t tapecachecount=0;                 // Entries in use
+static tapecacheentry *tapecachefill=NULL;       // Being copied in
+static uint32_t tapecacheclock=0;                // Preload stamps
+static uint32_t tapecachehits=0;                 // Preloads from RAM
+static uint32_t tapecachemisses=0;               // and from the sd card
+#endif
+
+// A memory dump is built, or read, as a whole file image in dumpimage,
+// so the sd card worker can write or read it a sector at a time while
+// the Z80 carries on. A dump being saved is a snapshot of the moment F12
+// was pressed. A dump being read replaces the emulator state in one go,
+// once the whole file has been read and checked.
+static uint8_t dumpimage[DUMPSIZE];     // Memory dump file image
+static uint32_t dumppos;                // Bytes written or read so far
+static FIL dumpfp;                      // Memory dump file
+static bool dumpbusy=false;             // dumpimage is in use
+
+static void tapewritefinish(void);
+static void tapecacheforget(const uint8_t *fname);
+static void tapecatdraw(void);
+
+/* One step of the cread() tape program - count is the number of pulses */
+/* or bytes sent                                                        */
+typedef struct tapestep {
+  uint8_t  kind;
+  uint16_t count;
+} tapestep;
+
+// The tape as sent by cread(). Only the parts of the tape format below
+// that a real MZ-80K needs to read a good tape are sent. The header and
+// body copies are only read if a checksum fails, so they are left out.
+// Note - 22,000 pulses in a real bgap, but anything > 100 will work
+// when a tape is being read (writing is different!)
+static const tapestep tapeprog[] = {
+  { TSHORT,  RBGAP_L },        // bgap
+  { TLONG,   BTM_L/2 },        // btm - first half is long pulses
+  { TSHORT,  BTM_L/2 },        //       second half short
+  { TLONG,   L_L },            // l
+  { THEADER, TAPEHEADERSIZE }, // hdr
+  { THCHK,   CHK_L/8 },        // chkh
+  { TLONG,   L_L },            // l
+  { TSHORT,  RSGAP_L },        // sgap
+  { TLONG,   STM_L/2 },        // stm
+  { TSHORT,  STM_L/2 },
+  { TLONG,   L_L },            // l
+  { TBODY,   0 },              // file
+  { TBCHK,   CHK_L/8 },        // chkf
+  { TEND,    L_L }             // l
+};
+
+/* One entry in the tape directory index */
+typedef struct tapeentry {
+  uint8_t  sfn[FF_SFN_BUF+1]; // Short (8.3) file name, used to open the file
+  uint8_t  htype;             // File type from the tape header
+  uint8_t  hname[17];         // File name from the tape header
+  uint32_t fsize;             // File size in bytes
+  uint16_t fdate,ftime;       // File modification date and time
+  uint32_t offset;            // Offset of the tape header in the file -
+                              // 0 for a .mzf file
+  bool     packed;            // Body is compressed (a .mzc file)
+  bool     inflash;           // Program is in the flash tape library -
+                              // offset is from the start of the library
+  uint32_t sclust;            // First cluster of the file on the sd card
+  bool     isdir;             // Entry is a subdirectory, or .. - hname is
+                              // its name
+} tapeentry;
+
+// Only the directory being browsed is indexed, so the index is the same
+// size however many directories and files there are on the card. F3
+// changes directory, and the index is rebuilt for the new one.
+static tapeentry tapeindex[TAPEINDEXMAX]; // .mzf files in directory order
+static uint16_t tapecount=0;              // Number of files in the index
+static uint8_t tapedir[TAPEDIRMAX]="/";   // Directory being browsed
+static int16_t tapedirsel=-1;             // Subdirectory shown by F1/F2
+static bool tapedirbusy=false;            // Change of directory queued
+
+// A tape preload from the sd card is done a step at a time by the sd
+// card worker: the file is opened, its cluster link map is built one
+// cluster per call, then its header is read and checked. Until then it
+// is only tapenextfp, so the tape already preloaded can still be read.
+static FIL tapenextfp;                    // Tape file being preloaded
+static DWORD tapenextclmt[TAPECLMTSIZE];  // Cluster link map being built
+static uint8_t tapenextmaplen;            // Entries in it - 0 if no map
+static uint32_t tapenextclusters;         // Clusters mapped so far
+static tapeentry tapenext;                // Tape index entry of the file
+static uint8_t tapenextmzc[MZCHDRSIZE];   // Compressed tape file header
+
+// The tape catalogue - Tab - shows a page of the tape index in place of
+// the emulator status lines, which are put back when it is closed. Keys
+// go to the catalogue rather than the MZ-80K while it is shown.
+static bool tapecatshown=false;           // Catalogue is shown
+static int16_t tapecatcursor=0;           // Entry under the cursor
+static uint8_t tapecatfind[TAPECATFIND+1];// Start of a name typed
+static uint8_t tapecatsaved[EMUSSIZE];    // Status lines it replaced
+
 /* MZ-80K tapes always have a 128 byte header, followed by a body */
 
 // Tape format is as follows: 
@@ -70,9 +294,17 @@ static FATFS fs;         // File system pointer for sd card
 // chkf - a copy of the file checksum
 // l - 1 long pulse
 
+/* Where status lines are written - the emulator status area, or while */
+/* the tape catalogue covers it, the copy put back when it closes       */
+uint8_t *tapestatusarea(void)
+{
+  return(tapecatshown ? tapecatsaved : mzemustatus);
+}
+
 /* Update the tape counter in the emulator status area, line 3 */
 void mzspinny(uint8_t state)
 {
+  uint8_t *status=tapestatusarea();
   uint8_t spos=EMULINE3;            // Write to fourth emulator status line
   static uint16_t spinny=0;         // Used to reset the tape counter
   static uint8_t ignore=0;          // Don't update the tape counter
@@ -92,15 +324,246 @@ void mzspinny(uint8_t state)
   // Write out value of spinny to the emulator status area
   ascii2mzdisplay("Tape counter: ",mzstr);
   for (uint8_t i=0;i<14;i++)         // Can't use strlen as space is 0x00!!
-    mzemustatus[spos++]=mzstr[i];
+    status[spos++]=mzstr[i];
   
   // Output the tape counter number
   uint16_t spinnyt=spinny;
-  mzemustatus[spos++]=0x20+(uint8_t)(spinnyt/100);
+  status[spos++]=0x20+(uint8_t)(spinnyt/100);
   spinnyt=spinnyt%100;
-  mzemustatus[spos++]=0x20+(uint8_t)(spinnyt/10);
+  status[spos++]=0x20+(uint8_t)(spinnyt/10);
   spinnyt=spinnyt%10;
-  mzemustatus[spos]=0x20+(uint8_t)spinnyt;
+  status[spos]=0x20+(uint8_t)spinnyt;
+
+  return;
+}
+
+/* Is a directory entry a file with extension ext - ".MZF" for a tape */
+/* file, ".MZC" for a compressed one or ".MZT" for a tape container?  */
+static bool tapeisfile(FILINFO *fno, const char *ext)
+{
+  uint8_t len=strlen(fno->altname);
+
+  if (fno->fattrib & AM_DIR) return(false);
+  return((len > 4) && (strcmp(&fno->altname[len-4],ext) == 0));
+}
+
+/* Add every program in a .mzt container to the tape index, straight */
+/* from the container's own index. Returns the number added.         */
+static uint16_t tapeindexcontainer(FILINFO *fno)
+{
+  FIL fp;
+  FRESULT res;
+  uint bytesread;
+  uint8_t mzthdr[MZTHDRSIZE];
+  uint8_t entry[MZTENTRYSIZE];
+  uint16_t nprogs,added=0,bodylen;
+  uint32_t offset;
+  tapeentry *te;
+
+  res=f_open(&fp,fno->altname,FA_READ|FA_OPEN_EXISTING);
+  if (res) {
+    SHOW("Error on file open for %s, status is %d\n",fno->altname,res);
+    return(0);
+  }
+  f_read(&fp,mzthdr,MZTHDRSIZE,&bytesread);
+  if ((bytesread != MZTHDRSIZE) || (memcmp(mzthdr,MZTMAGIC,4) != 0)) {
+    SHOW("Ignoring %s - not a tape container\n",fno->fname);
+    f_close(&fp);
+    return(0);
+  }
+
+  nprogs=mzt_get16(&mzthdr[4]);
+  for (uint16_t i=0;i<nprogs;i++) {
+    if (tapecount >= TAPEINDEXMAX) {
+      SHOW("Tape index full - ignoring the rest of %s\n",fno->fname);
+      break;
+    }
+    f_read(&fp,entry,MZTENTRYSIZE,&bytesread);
+    if (bytesread != MZTENTRYSIZE) {
+      SHOW("Index of %s is short - %d of %d programs\n",
+           fno->fname,i,nprogs);
+      break;
+    }
+    // Each program's tape header is checked as it is preloaded - the
+    // index alone is enough to turn away one that can't be there
+    offset=mzt_get32(&entry[MZTOFFSET]);
+    bodylen=mzt_get16(&entry[MZTLENGTH]);
+    if ((!mzt_entryok(offset,bodylen,nprogs,fno->fsize)) ||
+        ((entry[MZTTYPE] != MZFDUMP) && (bodylen > MZFBODYMAX))) {
+      SHOW("Ignoring program %d of %s - bad index entry\n",i,fno->fname);
+      continue;
+    }
+    te=&tapeindex[tapecount++];
+    strcpy(te->sfn,fno->altname);
+    te->fsize=fno->fsize;
+    te->fdate=fno->fdate;
+    te->ftime=fno->ftime;
+    te->offset=offset;
+    te->packed=false;
+    te->inflash=false;
+    te->isdir=false;
+    te->sclust=fp.obj.sclust;
+    te->htype=entry[MZTTYPE];
+    memcpy(te->hname,&entry[MZTNAME],17);
+    ++added;
+  }
+  f_close(&fp);
+  SHOW("Added %d programs from %s\n",added,fno->fname);
+
+  return(added);
+}
+
+/* Fill in a tape index entry from a file's 8.3 name and header */
+static bool tapeindexread(FILINFO *fno, tapeentry *entry)
+{
+  FIL fp;
+  FRESULT res;
+  uint bytesread;
+  uint8_t mzchdr[MZCHDRSIZE];   // Compressed tape file header
+  uint8_t hdr[TAPEHEADERSIZE];
+  uint8_t result;
+  mzfinfo info;
+  bool packed=tapeisfile(fno,".MZC");
+
+  res=f_open(&fp,fno->altname,FA_READ|FA_OPEN_EXISTING);
+  if (res) {
+    SHOW("Error on file open for %s, status is %d\n",fno->altname,res);
+    return(false);
+  }
+  // A compressed tape file has its own header before the tape header
+  if (packed) {
+    f_read(&fp,mzchdr,MZCHDRSIZE,&bytesread);
+    if ((bytesread != MZCHDRSIZE) || (memcmp(mzchdr,MZCMAGIC,4) != 0)) {
+      SHOW("Ignoring %s - not a compressed tape file\n",fno->fname);
+      f_close(&fp);
+      return(false);
+    }
+  }
+  f_read(&fp,hdr,TAPEHEADERSIZE,&bytesread);
+  entry->sclust=fp.obj.sclust;
+  f_close(&fp);
+  if (bytesread != TAPEHEADERSIZE) {
+    SHOW("Ignoring %s - no tape header\n",fno->fname);
+    return(false);
+  }
+  if (packed && !mzc_sizeok(mzchdr,hdr)) {
+    SHOW("Ignoring %s - image size does not match its tape header\n",
+         fno->fname);
+    return(false);
+  }
+  // The length of a compressed body is only known as it is read
+  result=mzf_parse(hdr,packed ? MZFANYSIZE : fno->fsize-TAPEHEADERSIZE,&info);
+  if (result != MZFOK) {
+    SHOW("Ignoring %s - %s\n",fno->fname,mzf_error(result));
+    return(false);
+  }
+
+  strcpy(entry->sfn,fno->altname);
+  entry->fsize=fno->fsize;
+  entry->fdate=fno->fdate;
+  entry->ftime=fno->ftime;
+  entry->offset=packed ? MZCHDRSIZE : 0;
+  entry->packed=packed;
+  entry->inflash=false;
+  entry->isdir=false;
+  entry->htype=hdr[0];
+  memcpy(entry->hname,&hdr[1],17);
+
+  return(true);
+}
+
+/* Add a subdirectory to the tape index. Its name is kept in the */
+/* entry's tape header name, in capitals, to show on the status   */
+/* line.                                                          */
+static void tapeindexdir(const TCHAR *sfn, const TCHAR *name)
+{
+  tapeentry *te;
+  uint8_t i;
+
+  if (tapecount >= TAPEINDEXMAX) {
+    SHOW("Tape index full - ignoring directory %s\n",name);
+    return;
+  }
+
+  te=&tapeindex[tapecount++];
+  memset(te,0,sizeof(tapeentry));
+  strcpy(te->sfn,sfn);
+  te->isdir=true;
+  for (i=0;(i<17)&&(name[i]!='\0');i++)
+    te->hname[i]=((name[i]>='a')&&(name[i]<='z')) ? name[i]-0x20 : name[i];
+  if (i < 17) te->hname[i]=0x0D;
+
+  return;
+}
+
+/* Build the tape index from the current directory of the sd card.   */
+/* This is done once for each directory, so F1 / F2 can go straight */
+/* to any file afterwards.                                          */
+static FRESULT tapeindexbuild(void)
+{
+  DIR dp;
+  FILINFO fno;
+  FRESULT res;
+
+  tapecount=0;
+  tapedirsel=-1;
+  if (tapedir[1] != '\0')       /* Below the root, the first entry goes */
+    tapeindexdir("..","..");     /* back up a level                      */
+
+  res=f_opendir(&dp,"");        /* Open the current directory on the sd card */
+  if (res) {
+    SHOW("Error on directory open for %s, status is %d\n",tapedir,res);
+    return(res);
+  }
+
+  while (((res=f_readdir(&dp,&fno)) == FR_OK) && (fno.fname[0] != 0)) {
+    if (fno.fattrib & AM_DIR) {  /* Subdirectories can be opened with F3 */
+      if (!(fno.fattrib & (AM_HID|AM_SYS)) && (fno.fname[0] != '.'))
+        tapeindexdir(fno.altname,fno.fname);
+      continue;
+    }
+    if (tapeisfile(&fno,".MZT")) {      /* Containers add all their programs */
+      tapeindexcontainer(&fno);
+      continue;
+    }
+    if (!tapeisfile(&fno,".MZF") && !tapeisfile(&fno,".MZC")) {
+                                /* Other files ignored */
+      SHOW("Ignoring %s\n",fno.fname);
+      continue;
+    }
+    if (tapecount >= TAPEINDEXMAX) {
+      SHOW("Tape index full - ignoring %s and later files\n",fno.fname);
+      break;
+    }
+    if (tapeindexread(&fno,&tapeindex[tapecount]))
+      ++tapecount;
+  }
+  f_closedir(&dp);
+  SHOW("Tape index built - %d files\n",tapecount);
+
+  return(res);
+}
+
+/* Add a newly written file to the tape index, or update its entry */
+static void tapeindexupdate(const TCHAR *fname)
+{
+  FILINFO fno;
+  uint16_t i;
+
+  if ((f_stat(fname,&fno) != FR_OK) || (!tapeisfile(&fno,".MZF"))) return;
+  tapecacheforget(fno.altname);  // Any cached copy is out of date
+
+  for (i=0;i<tapecount;i++)
+    if ((tapeindex[i].offset == 0) && (!tapeindex[i].inflash) &&
+        (strcmp(tapeindex[i].sfn,fno.altname) == 0)) break;
+  if (i >= TAPEINDEXMAX) {
+    SHOW("Tape index full - %s not added\n",fname);
+    return;
+  }
+  if (tapeindexread(&fno,&tapeindex[i]) && (i == tapecount)) {
+    ++tapecount;                // New files are added at the end
+    SHOW("Added %s to tape index as file %d\n",fname,i);
+  }
 
   return;
 }
@@ -115,18 +578,141 @@ FRESULT tapeinit(void)
   busy_wait_ms(500);
   res=f_mount(&fs, "", 1);
 
+  // Index the tape files on the card
+  if (res == FR_OK)
+    res=tapeindexbuild();
+
   return(res);
 }
 
-/* Save MZ-80K user RAM to a file */
+/* Index the programs in the flash tape library, in place of the sd */
+/* card. Returns the number of programs found - 0 if there is no    */
+/* library, as erased flash doesn't start with the container magic. */
+uint16_t tapeflashinit(void)
+{
+  const uint8_t *entry;
+  tapeentry *te;
+  uint16_t nprogs;
+  uint32_t offset,bodylen;
+  uint8_t result;
+  mzfinfo info;
+
+  tapecount=0;
+  if (memcmp(TAPEFLASH,MZTMAGIC,4) != 0) {
+    SHOW("No tape library in flash at 0x%08x\n",(uint)TAPEFLASHOFFSET);
+    return(0);
+  }
+
+  nprogs=mzt_get16(&TAPEFLASH[4]);
+  if (!mzt_indexok(nprogs,TAPEFLASHSIZE)) {
+    SHOW("Flash library index of %d programs is past the end of flash\n",
+         nprogs);
+    return(0);
+  }
+  for (uint16_t i=0;i<nprogs;i++) {
+    if (tapecount >= TAPEINDEXMAX) {
+      SHOW("Tape index full - ignoring the rest of the flash library\n");
+      break;
+    }
+    entry=&TAPEFLASH[MZTHDRSIZE+i*MZTENTRYSIZE];
+    offset=mzt_get32(&entry[MZTOFFSET]);
+    bodylen=mzt_get16(&entry[MZTLENGTH]);
+    if (!mzt_entryok(offset,bodylen,nprogs,TAPEFLASHSIZE)) {
+      SHOW("Ignoring flash library program %d - bad index entry\n",i);
+      continue;
+    }
+    // The tape header is in flash too, so can be checked now
+    result=mzf_parse(&TAPEFLASH[offset],bodylen,&info);
+    if (result != MZFOK) {
+      SHOW("Ignoring flash library program %d - %s\n",i,mzf_error(result));
+      continue;
+    }
+
+    te=&tapeindex[tapecount++];
+    te->sfn[0]='\0';
+    te->fsize=TAPEHEADERSIZE+bodylen;
+    te->fdate=0;
+    te->ftime=0;
+    te->offset=offset;
+    te->packed=false;
+    te->inflash=true;
+    te->isdir=false;
+    te->sclust=0;
+    te->htype=entry[MZTTYPE];
+    memcpy(te->hname,&entry[MZTNAME],17);
+  }
+
+  SHOW("Tape index built from flash library - %d programs\n",tapecount);
+  return(tapecount);
+}
+
+/* Write the next sector of a memory dump - sd card worker job */
+static uint8_t dumpwritejob(int16_t unused, bool first)
+{
+  uint32_t len;
+  uint bw;
+  FRESULT res;
+
+  if (first) {
+    // Open a file on the sd card
+    res=f_open(&dumpfp,DUMPFILE,FA_CREATE_ALWAYS|FA_WRITE);
+    if (res) {
+      SHOW("Error on file open for MZDUMP.MZF, status is %d\n",res);
+      mzsdiostatus("Memory dump failed");
+      dumpbusy=false;
+      return(SDIOFAILED);
+    }
+
+    // Allocate the whole file in one contiguous block if the card
+    // has room for it. If not, FatFs allocates clusters as it goes.
+    if (f_expand(&dumpfp,DUMPSIZE,1) != FR_OK)
+      SHOW("No contiguous space for MZDUMP.MZF\n");
+    dumppos=0;
+    return(SDIOMORE);
+  }
+
+  // A few whole sectors per call, straight from the snapshot - FatFs
+  // sends them to the card with one multi-block write
+  if (dumppos < DUMPSIZE) {
+    len=DUMPSIZE-dumppos;
+    if (len > DUMPSLICE) len=DUMPSLICE;
+    res=f_write(&dumpfp,&dumpimage[dumppos],len,&bw);
+    if ((res != FR_OK) || (bw != len)) {
+      SHOW("Error writing MZDUMP.MZF, status is %d\n",res);
+      // f_expand() has already made the file full size - remove it, so
+      // stale clusters are never offered as a memory dump
+      f_close(&dumpfp);
+      f_unlink(DUMPFILE);
+      tapecacheforget(DUMPFILE);
+      mzsdiostatus("Memory dump failed");
+      dumpbusy=false;
+      return(SDIOFAILED);
+    }
+    dumppos+=len;
+    return(SDIOMORE);
+  }
+
+  // Close the file and add it to the tape index
+  f_close(&dumpfp);
+  tapeindexupdate(DUMPFILE);
+  SHOW("Memory dump: %d bytes written to MZDUMP.MZF\n",(uint)DUMPSIZE);
+  mzsdiostatus("Memory dump saved");
+  dumpbusy=false;
+
+  return(SDIODONE);
+}
+
+/* Save MZ-80K user RAM to a file. The snapshot is taken now and */
+/* written to the sd card by the sd card worker.                 */
 FRESULT mzsavedump(void)
 {
-  FIL fp;                           // File pointer
-  FRESULT res;                      // FatFS function result
-  uint bw;                          // Number of bytes written to file
-  uint8_t uramheader[TAPEHEADERSIZE];  // A 'tape' header for the memory dump
-  uint8_t dumpfile[11] =            // Memory dump filename
-  { 'M','Z','D','U','M','P','.','M','Z','F','\0' };
+  uint8_t *uramheader=dumpimage;    // A 'tape' header for the memory dump
+
+  if (dumpbusy) {
+    SHOW("Memory dump already in progress\n");
+    mzsdiostatus("sd card busy");
+    return(FR_LOCKED);
+  }
 
   memset(uramheader,0,TAPEHEADERSIZE); // Clear the 'tape' header
   uramheader[0] = 0x20;             // Use 0x20 as the header identifier
@@ -144,190 +730,613 @@ FRESULT mzsavedump(void)
   uramheader[11]= 0x9e;             // p
   uramheader[12]= 0x0d;             // <end of name>
 
-  // Open a file on the sd card
-  res=f_open(&fp,dumpfile,FA_CREATE_ALWAYS|FA_WRITE);
-  if (res) {
-    SHOW("Error on file open for MZDUMP.MZF, status is %d\n",res);
-    return(res);
-  }
+  // The 'tape' contents - everything in mzuserram and mzvram, the z80
+  // state and the 8253 state
+  memcpy(&dumpimage[DUMPURAM],mzuserram,URAMSIZE);
+  memcpy(&dumpimage[DUMPVRAM],mzvram,VRAMSIZE);
+  memcpy(&dumpimage[DUMPCPU],&mzcpu,sizeof(mzcpu));
+  memcpy(&dumpimage[DUMPPIT],&mzpit,sizeof(mzpit));
 
-  // Write the 'tape' header
-  f_write(&fp, uramheader, TAPEHEADERSIZE, &bw);
-  SHOW("Memory dump header: %d bytes written to MZDUMP.MZF\n",bw);
+  if (!mzsdiorequest(dumpwritejob,0)) return(FR_LOCKED);
+  dumpbusy=true;
+  mzsdiostatus("Saving memory dump");
 
-  // Write 'tape' contents - everything in mzuserram 
-  f_write(&fp, mzuserram, URAMSIZE, &bw); 
-  SHOW("Memory dump user RAM: %d bytes written to MZDUMP.MZF\n",bw);
+  return(FR_OK);
+}
 
-  // Write 'tape' contents - everything in mzvram
-  f_write(&fp, mzvram, VRAMSIZE, &bw); 
-  SHOW("Memory dump video RAM: %d bytes written to MZDUMP.MZF\n",bw);
+/* Read the next sector of a memory dump - sd card worker job */
+static uint8_t dumpreadjob(int16_t unused, bool first)
+{
+  uint32_t len;
+  uint br=0;
+  FRESULT res;
 
-  // Write 'tape' contents - z80 state
-  f_write(&fp, &mzcpu, sizeof(mzcpu), &bw);
-  SHOW("Memory dump z80 cpu state: %d bytes written to MZDUMP.MZF\n",bw);
+  if (first) {
+    // Open a file on the sd card
+    res=f_open(&dumpfp,DUMPFILE,FA_READ|FA_OPEN_EXISTING);
+    if (res) {
+      SHOW("Error on file open for MZDUMP.MZF, status is %d\n",res);
+      mzsdiostatus("Memory dump read failed");
+      dumpbusy=false;
+      return(SDIOFAILED);
+    }
+    dumppos=0;
+    return(SDIOMORE);
+  }
 
-  // Write 'tape' contents - 8253 state
-  f_write(&fp, &mzpit, sizeof(mzpit), &bw);
-  SHOW("Memory dump 8253 state: %d bytes written to MZDUMP.MZF\n",bw);
+  if (dumppos < DUMPSIZE) {
+    len=DUMPSIZE-dumppos;
+    if (len > FF_MAX_SS) len=FF_MAX_SS;
+    res=f_read(&dumpfp,&dumpimage[dumppos],len,&br);
+    if ((res != FR_OK) || (br != len)) {
+      SHOW("Error on read - expecting %d bytes, got %d\n",
+           (uint)DUMPSIZE,(uint)(dumppos+br));
+      res=FR_INT_ERR;
+    }
+    // Check the header is what we're expecting
+    else if ((dumppos == 0) && (dumpimage[0] != 0x20)) {
+      SHOW("Error on header read - expecting type 0x20\n");
+      res=FR_INT_ERR;
+    }
+    if (res) {
+      f_close(&dumpfp);
+      mzsdiostatus("Memory dump read failed");
+      dumpbusy=false;
+      return(SDIOFAILED);
+    }
+    dumppos+=len;
+    return(SDIOMORE);
+  }
 
-  // Close the file and return
-  f_close(&fp);
+  // Success - close the file. The whole dump has been read and checked,
+  // so replace mzuserram, mzvram, the z80 state and the 8253 state.
+  f_close(&dumpfp);
+  memcpy(mzuserram,&dumpimage[DUMPURAM],URAMSIZE);
+  memcpy(mzvram,&dumpimage[DUMPVRAM],VRAMSIZE);
+  memcpy(&mzcpu,&dumpimage[DUMPCPU],sizeof(mzcpu));
+  memcpy(&mzpit,&dumpimage[DUMPPIT],sizeof(mzpit));
+  SHOW("Memory dump read from MZDUMP.MZF\n");
+  mzsdiostatus("Memory dump loaded");
+  dumpbusy=false;
+
+  return(SDIODONE);
+}
+
+/* Read MZ-80K memory dump. The file is read by the sd card worker */
+/* and replaces the emulator state once it has all been read.      */
+FRESULT mzreaddump(void)
+{
+  if (dumpbusy) {
+    SHOW("Memory dump already in progress\n");
+    mzsdiostatus("sd card busy");
+    return(FR_LOCKED);
+  }
+
+  if (!mzsdiorequest(dumpreadjob,0)) return(FR_LOCKED);
+  dumpbusy=true;
+  mzsdiostatus("Loading memory dump");
 
   return(FR_OK);
 }
 
-/* Read MZ-80K memory dump        */
-FRESULT mzreaddump(void)
+/* Build a cluster link map for a file opened for reading, so a seek */
+/* anywhere in it is a table lookup rather than a walk along the FAT */
+/* chain. A file in too many fragments for the table seeks as usual. */
+static void tapelinkmap(FIL *fp, DWORD *clmt, UINT size)
 {
-  FIL fp;                           // File pointer
-  FRESULT res;                      // FatFS function result
-  uint br;                          // Number of bytes read from file
-  uint8_t uramheader[TAPEHEADERSIZE];  // A 'tape' header for the memory dump
-  uint8_t dumpfile[11] =            // Memory dump filename
-  { 'M','Z','D','U','M','P','.','M','Z','F','\0' };
+  FRESULT res;
 
-  // Open a file on the sd card
-  res=f_open(&fp,dumpfile,FA_READ|FA_WRITE);
-  if (res) {
-    SHOW("Error on file open for MZDUMP.MZF, status is %d\n",res);
-    return(res);
+  fp->cltbl=clmt;
+  clmt[0]=size;
+  res=f_lseek(fp,CREATE_LINKMAP);
+  if (res != FR_OK) {
+    SHOW("No cluster link map - %d entries needed\n",(uint)clmt[0]);
+    fp->cltbl=NULL;
   }
+  f_lseek(fp,0);
 
-  // Read the header - check it's what we're expecting
-  f_read(&fp,uramheader,TAPEHEADERSIZE,&br);
-  if (uramheader[0] != 0x20) {
-    SHOW("Error on header read - expecting type 0x20\n");
-    f_close(&fp);
-    return(FR_INT_ERR);      // assertion failed
+  return;
+}
+
+/* Make a whole tape image in memory - in flash or the tape cache -  */
+/* the preloaded tape. It is read in place, so both its checksums    */
+/* can be worked out now rather than as cread() sends it.            */
+static void tapeimagepreload(const uint8_t *image)
+{
+  mzfinfo info;
+
+  tapewritefinish();
+  if (tapemode != TAPECLOSED) {
+    f_close(&tapefp);
+    tapemode=TAPECLOSED;
   }
+  tapeimage=image;
+  tapebase=0;
+  tapepacked=false;
+  memcpy(header,tapeimage,TAPEHEADERSIZE);
+  mzf_parse(header,MZFANYSIZE,&info);   // Checked when it was indexed
+  tapehchk=info.hchk;
+  tapeimagebchk=mzf_checksum(&tapeimage[TAPEHEADERSIZE],info.bodylen);
 
-  // Read mzuserram
-  f_read(&fp, mzuserram, URAMSIZE, &br);
-  if (br != URAMSIZE) {
-    SHOW("Error on userram read - expecting %d bytes, got %d\n",URAMSIZE,br);
-    f_close(&fp);
-    return(FR_INT_ERR);      // assertion failed
+  return;
+}
+
+#ifdef PICO2
+/* Show the tape cache size and hit rate on the fourth emulator status */
+/* line, after the tape counter                                        */
+static void tapecachestats(void)
+{
+  uint8_t line[20];
+  uint8_t mzstr[20];
+  uint32_t bytes=0,preloads=tapecachehits+tapecachemisses;
+
+  for (uint8_t i=0;i<tapecachecount;i++)
+    if (tapecacheent[i].valid) bytes+=tapecacheent[i].size;
+
+  snprintf(line,sizeof(line),"Cache:%3dK hit:%3d%%",(uint)(bytes+1023)/1024,
+           preloads ? (uint)((tapecachehits*100)/preloads) : 0);
+  ascii2mzdisplay(line,mzstr);
+  memcpy(tapestatusarea()+EMULINE3+20,mzstr,19); // Last column is diag's
+
+  return;
+}
+
+/* Remove entry i. Its image is left where it is, to be overwritten - */
+/* only done when a tape is preloaded from the sd card, as tapeimage   */
+/* might point to it.                                                  */
+static void tapecacheremove(uint8_t i)
+{
+  for (uint8_t j=i+1;j<tapecachecount;j++)
+    tapecacheent[j-1]=tapecacheent[j];
+  --tapecachecount;
+
+  return;
+}
+
+/* Find the first gap in tapecache that an image of size bytes fits */
+/* in. Returns the entry it would go before - tapecachecount if it  */
+/* goes after them all - or -1 if there is no gap big enough.       */
+static int8_t tapecachegap(uint32_t size, uint32_t *start)
+{
+  uint32_t end=0;                     // End of the image before the gap
+
+  for (uint8_t i=0;i<tapecachecount;i++) {
+    if (tapecacheent[i].start-end >= size) {
+      *start=end;
+      return(i);
+    }
+    end=tapecacheent[i].start+tapecacheent[i].size;
+  }
+  if (TAPECACHESIZE-end >= size) {
+    *start=end;
+    return(tapecachecount);
   }
 
-  // Read mzvram
-  f_read(&fp, mzvram, VRAMSIZE, &br);
-  if (br != VRAMSIZE) {
-    SHOW("Error on video ram read - expecting %d bytes, got %d\n",VRAMSIZE,br);
-    f_close(&fp);
-    return(FR_INT_ERR);      // assertion failed
+  return(-1);
+}
+
+/* Find the cached image of a tape. Returns NULL if it isn't cached. */
+static tapecacheentry *tapecachefind(const tapeentry *te)
+{
+  tapecacheentry *ce;
+
+  for (uint8_t i=0;i<tapecachecount;i++) {
+    ce=&tapecacheent[i];
+    if ((ce->valid) && (ce->offset == te->offset) &&
+        (ce->sclust == te->sclust) &&
+        (ce->fsize == te->fsize) && (ce->fdate == te->fdate) &&
+        (ce->ftime == te->ftime) && (strcmp(ce->sfn,te->sfn) == 0))
+      return(ce);
   }
 
-  // Read z80 state
-  f_read(&fp, &mzcpu, sizeof(mzcpu), &br);
-  if (br != sizeof(mzcpu)) {
-    SHOW("Error on z80 read - expecting %d bytes, got %d\n",sizeof(mzcpu),br);
-    f_close(&fp);
-    return(FR_INT_ERR);      // assertion failed
+  return(NULL);
+}
+
+/* Make room for the image of a tape just preloaded from the sd card, */
+/* to be copied in as cread() sends it. Returns NULL if it won't fit.  */
+static tapecacheentry *tapecacheadd(const tapeentry *te, uint32_t size)
+{
+  tapecacheentry *ce;
+  uint32_t start;
+  int8_t slot;
+  uint8_t i,lru;
+
+  tapecachefill=NULL;
+  if (size > TAPECACHESIZE) return(NULL);
+
+  // Images that were never finished, or are out of date, go first
+  for (i=0;i<tapecachecount;)
+    if (!tapecacheent[i].valid || (tapecacheent[i].sfn[0] == '\0'))
+      tapecacheremove(i);
+    else
+      ++i;
+
+  // Then the least recently preloaded, until there is a gap for it
+  for (;;) {
+    slot=(tapecachecount < TAPECACHEMAX) ? tapecachegap(size,&start) : -1;
+    if (slot >= 0) break;
+    lru=0;
+    for (i=1;i<tapecachecount;i++)
+      if (tapecacheent[i].used < tapecacheent[lru].used) lru=i;
+    tapecacheremove(lru);
   }
 
-  // Read 8253 state
-  f_read(&fp, &mzpit, sizeof(mzpit), &br);
-  if (br != sizeof(mzpit)) {
-    SHOW("Error on 8253 read - expecting %d bytes, got %d\n",sizeof(mzpit),br);
-    f_close(&fp);
-    return(FR_INT_ERR);      // assertion failed
+  // Keep the entries in tapecache order
+  for (i=tapecachecount;i>slot;i--)
+    tapecacheent[i]=tapecacheent[i-1];
+  ++tapecachecount;
+  ce=&tapecacheent[slot];
+  strcpy(ce->sfn,te->sfn);
+  ce->offset=te->offset;
+  ce->sclust=te->sclust;
+  ce->fsize=te->fsize;
+  ce->fdate=te->fdate;
+  ce->ftime=te->ftime;
+  ce->start=start;
+  ce->size=size;
+  ce->used=++tapecacheclock;
+  ce->valid=false;
+
+  return(ce);
+}
+
+/* Copy the part of the tape image just read into the window to the */
+/* cache. The image is usable once its last part has been copied -   */
+/* cread() always sends a tape from the start, so all of it has been. */
+static void tapecachestore(uint8_t half)
+{
+  uint32_t len;
+
+  if ((tapecachefill == NULL) || (tapebufpos >= tapecachefill->size))
+    return;
+
+  len=tapecachefill->size-tapebufpos;
+  if (len > TAPEBUFSIZE) len=TAPEBUFSIZE;
+  memcpy(&tapecache[tapecachefill->start+tapebufpos],tapebuf[half],len);
+  if (tapebufpos+len == tapecachefill->size) {
+    tapecachefill->valid=true;
+    tapecachefill=NULL;
+    tapecachestats();
   }
 
-  // Success - close file
-  f_close(&fp);
+  return;
+}
 
-  return(FR_OK);
+/* Stop copying the preloaded tape to the cache - it has been replaced */
+static void tapecachestop(void)
+{
+  tapecachefill=NULL;
+  return;
 }
 
-/* Preload a tape file into the header/body memory ready for LOAD */
-int16_t tapeloader(int16_t n)
+/* Mark any cached images of a file as out of date - it has been */
+/* written. They are removed when room is next made.              */
+static void tapecacheforget(const uint8_t *fname)
+{
+  for (uint8_t i=0;i<tapecachecount;i++)
+    if (strcmp(tapecacheent[i].sfn,fname) == 0) {
+      tapecacheent[i].sfn[0]='\0';
+      tapecacheent[i].valid=false;
+      if (tapecachefill == &tapecacheent[i]) tapecachefill=NULL;
+    }
+
+  return;
+}
+
+/* Preload the nth file on the tape from the cache, if it is there. */
+/* Returns false if it isn't.                                       */
+static bool tapecachepreload(int16_t n)
+{
+  tapecacheentry *ce=tapecachefind(&tapeindex[n]);
+
+  if (ce == NULL) return(false);
+
+  tapecachefill=NULL;
+  tapeimagepreload(&tapecache[ce->start]);
+  ce->used=++tapecacheclock;
+  ++tapecachehits;
+  tapecachestats();
+  SHOW("Preloaded %s from the tape cache\n",ce->sfn);
+
+  return(true);
+}
+
+/* A tape has been preloaded from the sd card - cache it as it is read */
+static void tapecachemiss(const tapeentry *te)
+{
+  ++tapecachemisses;
+  tapecachefill=tapecacheadd(te,TAPEHEADERSIZE+
+                             (((header[19]<<8)&0xFF00)|header[18]));
+  tapecachestats();
+
+  return;
+}
+#else
+static void tapecachestore(uint8_t half) { return; }
+static void tapecachestop(void) { return; }
+static void tapecacheforget(const uint8_t *fname) { return; }
+static bool tapecachepreload(int16_t n) { return(false); }
+static void tapecachemiss(const tapeentry *te) { return; }
+#endif
+
+/* Decompress the next len bytes of a compressed tape - the header, */
+/* then the body. Returns the number of bytes made.                 */
+static uint tapeunpack(uint8_t *dest, uint len)
+{
+  uint made=0;
+  uint32_t want,got;
+
+  // The tape header is stored uncompressed
+  while ((made < len) && (tapeunpacked < TAPEHEADERSIZE))
+    dest[made++]=header[tapeunpacked++];
+
+  while ((made < len) && (tapeunpacked < TAPEHEADERSIZE+tapebodylen)) {
+    if (tapeinpos >= tapeinlen) {
+      // Read up to the end of the current sector of the file
+      tapeinpos=0;
+      f_read(&tapefp,tapein,TAPEBUFSIZE-(f_tell(&tapefp)%TAPEBUFSIZE),
+             &tapeinlen);
+      if (tapeinlen == 0) break;        // File is short
+    }
+    want=TAPEHEADERSIZE+tapebodylen-tapeunpacked;
+    if (want > len-made) want=len-made;
+    tapeinpos+=mzc_decode(&tapeunz,&tapein[tapeinpos],tapeinlen-tapeinpos,
+                          &dest[made],want,&got);
+    made+=got;
+    tapeunpacked+=got;
+  }
+
+  return(made);
+}
+
+/* Read the next sector of the tape file into one half of the window */
+static void tapebufread(uint8_t half)
+{
+  uint bytesread=0;
+  uint32_t bodystart,bodyend;
+
+  // A tape image in memory is read in place by tapebyte(), and its
+  // body checksum is already known
+  if (tapeimage != NULL) {
+    tapebufpos+=TAPEBUFSIZE;
+    return;
+  }
+
+  if ((tapemode == TAPEREAD) && tapepacked)
+    bytesread=tapeunpack(tapebuf[half],TAPEBUFSIZE);
+  else if (tapemode == TAPEREAD)
+    f_read(&tapefp,tapebuf[half],TAPEBUFSIZE,&bytesread);
+  // Anything past the end of the file (or unreadable) is sent as zeros
+  if (bytesread < TAPEBUFSIZE)
+    memset(&tapebuf[half][bytesread],0x00,TAPEBUFSIZE-bytesread);
+  tapecachestore(half);
+
+  // Add the part of the body just read to the body checksum
+  bodystart=(tapebufpos<TAPEHEADERSIZE) ? TAPEHEADERSIZE : tapebufpos;
+  bodyend=TAPEHEADERSIZE+tapebodylen;
+  if (bodyend > tapebufpos+TAPEBUFSIZE) bodyend=tapebufpos+TAPEBUFSIZE;
+  if (bodystart < bodyend)
+    tapebchk+=mzf_checksum(&tapebuf[half][bodystart-tapebufpos],
+                           bodyend-bodystart);
+  tapebufpos+=TAPEBUFSIZE;
+
+  return;
+}
+
+/* Fill the window with the start of the tape file, ready for cread() */
+static void tapebufrewind(void)
+{
+  tapewritefinish();       // A tape just saved can be read straight back
+  if (tapemode == TAPEREAD) {
+    // A compressed body is decompressed from its start
+    if (f_lseek(&tapefp,tapepacked ? tapebase+TAPEHEADERSIZE : tapebase)
+        != FR_OK)
+      SHOW("Error seeking to the tape body\n");
+  }
+  mzc_init(&tapeunz);
+  tapeinlen=tapeinpos=0;
+  tapeunpacked=0;
+  tapebodylen=((header[19]<<8)&0xFF00)|header[18];
+  tapebufpos=0;
+  tapebchk=(tapeimage != NULL) ? tapeimagebchk : 0;
+  tapebufread(0);
+  tapebufread(1);
+
+  return;
+}
+
+/* Return byte n of the header, body or one of their checksums */
+static inline uint8_t tapebyte(uint8_t kind, uint16_t n)
+{
+  switch (kind) {
+    case THEADER: return(header[n]);
+    case THCHK:   return((n==0) ? (tapehchk>>8)&0xFF : tapehchk&0xFF);
+    case TBCHK:   return((n==0) ? (tapebchk>>8)&0xFF : tapebchk&0xFF);
+    default:      return((tapeimage != NULL) ?
+                           tapeimage[TAPEHEADERSIZE+n] : TAPEBUFBYTE(n));
+  }
+}
+
+/* Start preloading the nth file on the tape from the sd card - open  */
+/* it, and read the header of a compressed tape file. Returns false   */
+/* if it can't be read.                                               */
+static bool tapefileopen(int16_t n)
 {
-  FIL fp;
-  DIR dp;
-  FILINFO fno;
   FRESULT res;
-  uint bytesread,bodybytes,dc;
-  uint8_t mzstr[25];
+  uint bytesread;
 
-  res=f_opendir(&dp,"/");	/* Open the root directory on the sd card */
+  // The index entry is copied, as the index can change before the
+  // preload is finished
+  tapenext=tapeindex[n];
+  res=f_open(&tapenextfp,tapenext.sfn,FA_READ|FA_OPEN_EXISTING);
   if (res) {
-    SHOW("Error on directory open for /, status is %d\n",res);
-    return(-1);
+    SHOW("Error on file open for %s, status is %d\n",tapenext.sfn,res);
+    return(false);
   }
+  if (tapenext.packed)
+    f_read(&tapenextfp,tapenextmzc,MZCHDRSIZE,&bytesread);
+  tapenextclmt[0]=TAPECLMTSIZE;
+  tapenextmaplen=1;
+  tapenextclusters=0;
 
-  // If we're passed a number less than 0, use 0 (first file).
-  if (n < 0) 
-    n=0;
+  return(true);
+}
 
-  dc=0;                         
-  while (dc <= n) {             /* Find the nth file in the directory */
-    res=f_readdir(&dp, &fno);   /* (i.e. the nth file on the 'tape')  */
-    if (res != FR_OK || fno.fname[0] == 0) {
-      /* We're at the end of the tape or an error has happened */
-      /* Return with no change to the preloaded file */
-      SHOW("End of tape, status is %d\n",res);
-      f_closedir(&dp);
-      return(-1);
+/* Add the next cluster of the file being preloaded to its cluster link */
+/* map - one FAT entry read. Returns true once the map is finished, or  */
+/* the file is in too many fragments for it.                            */
+static bool tapefilemap(void)
+{
+  FIL *fp=&tapenextfp;
+  DWORD *clmt=tapenextclmt;
+  FSIZE_t pos;
+  DWORD clust;
+
+  // f_lseek() walks the FAT chain on from the current cluster, so a seek
+  // one cluster further on reads one entry. fp->clust is then the
+  // cluster holding the byte before the new position.
+  pos=(FSIZE_t)(tapenextclusters+1)*fp->obj.fs->csize*FF_MAX_SS;
+  if (pos > f_size(fp)) pos=f_size(fp);
+  if (pos > 0) {
+    if (f_lseek(fp,pos) != FR_OK) {
+      SHOW("Error reading the FAT chain of %s\n",tapenext.sfn);
+      tapenextmaplen=0;
+      return(true);
     }
-    if (fno.fattrib & AM_DIR)    /* All subdirectories ignored at present */
-      SHOW("Ignoring directory %s\n",fno.fname);
-    else 
-      ++dc;                      /* Increment the file count */
+    clust=fp->clust;
+    // Runs of consecutive clusters are held as {length, first cluster}
+    if ((tapenextmaplen > 1) &&
+        (clmt[tapenextmaplen-1]+clmt[tapenextmaplen-2] == clust))
+      ++clmt[tapenextmaplen-2];
+    else if (tapenextmaplen+2 < TAPECLMTSIZE) {
+      clmt[tapenextmaplen++]=1;
+      clmt[tapenextmaplen++]=clust;
+    }
+    else {
+      SHOW("No cluster link map - %s is too fragmented\n",tapenext.sfn);
+      tapenextmaplen=0;
+      return(true);
+    }
+    ++tapenextclusters;
   }
-  f_closedir(&dp);               /* Close the directory pointer */
-  
-  // We now have the next file on the tape - preload it
-  res=f_open(&fp,fno.fname,FA_READ|FA_OPEN_EXISTING);
-  if (res) {
-    SHOW("Error on file open for %s, status is %d\n",fno.fname,res);
-    return(-1);
+  if (pos < f_size(fp)) return(false);
+
+  clmt[tapenextmaplen]=0;
+  clmt[0]=tapenextmaplen+1;             // Entries used, as FatFs leaves it
+
+  return(true);
+}
+
+/* Finish preloading the file from the sd card - read and check its */
+/* tape header, and make it the preloaded tape. Returns false if it */
+/* can't be read.                                                   */
+static bool tapefilepreload(void)
+{
+  FIL *fp=&tapenextfp;
+  uint bytesread;
+  uint8_t *fname=tapenext.sfn;
+  uint32_t offset=tapenext.offset;
+  uint8_t hdr[TAPEHEADERSIZE];
+  uint8_t result;
+  mzfinfo info;
+
+  // With the link map in place, seeks are table lookups. Programs in a
+  // .mzt container start part way through the file, and a compressed
+  // tape file's header comes before its tape header.
+  fp->cltbl=(tapenextmaplen > 0) ? tapenextclmt : NULL;
+  if (f_lseek(fp,offset) != FR_OK) {
+    SHOW("Error seeking to program at %d in %s\n",(uint)offset,fname);
+    f_close(fp);
+    return(false);
   }
   
   // MZ-80K tape headers are always 128 bytes
-  f_read(&fp,header,TAPEHEADERSIZE,&bytesread);
+  f_read(fp,hdr,TAPEHEADERSIZE,&bytesread);
   if (bytesread != TAPEHEADERSIZE) {
     SHOW("Header error - only read %d of 128 bytes\n",bytesread);
-    f_close(&fp);
-    return(-1);
+    f_close(fp);
+    return(false);
+  }
+  // The decompressor makes exactly the body length in the tape header,
+  // so a compressed file must agree with it about the image size
+  if (tapenext.packed && !mzc_sizeok(tapenextmzc,hdr)) {
+    SHOW("Header error - image size does not match the tape header\n");
+    f_close(fp);
+    return(false);
   }
 
-  // Work out how many bytes to read from the header - stored in
-  // locations header[19] and header[18] (msb, lsb)
-  bodybytes=((header[19]<<8)&0xFF00)|header[18];
-  SHOW("Tape body length for tape %d is %d\n",n,bodybytes);
-  f_read(&fp,body,bodybytes,&bytesread);
-  if (bytesread != bodybytes) {
-    SHOW("Body error - only read %d of %d bytes\n",bytesread,bodybytes);
-    f_close(&fp);
-    return(-1);
+  // Check the header against the memory map and the file size. The
+  // length of a compressed body is only known as it is read.
+  result=mzf_parse(hdr,tapenext.packed ? MZFANYSIZE :
+                   f_size(fp)-offset-TAPEHEADERSIZE,&info);
+  SHOW("Tape body length for %s is %d\n",fname,info.bodylen);
+  if (result != MZFOK) {
+    SHOW("Header error - %s\n",mzf_error(result));
+    f_close(fp);
+    return(false);
   }
 
+  // This file is now the preloaded tape - keep it open so that
+  // cread() can stream its body
+  tapewritefinish();
+  if (tapemode != TAPECLOSED)
+    f_close(&tapefp);
+  tapefp=*fp;
+  memcpy(tapeclmt,tapenextclmt,sizeof(tapeclmt));
+  if (tapefp.cltbl != NULL) tapefp.cltbl=tapeclmt;
+  tapemode=TAPEREAD;
+  tapebase=offset;
+  tapepacked=tapenext.packed;
+  tapeimage=NULL;
+  memcpy(header,hdr,TAPEHEADERSIZE);
+  tapehchk=info.hchk;
+  tapecachemiss(&tapenext);
+  SHOW("Successful preload of %s\n",fname);
+
+  return(true);
+}
+
+/* Preload the nth file on the tape from the flash tape library. The */
+/* body is read in place through XIP - only the header is copied.    */
+static void tapeflashpreload(int16_t n)
+{
+  tapeimagepreload(&TAPEFLASH[tapeindex[n].offset]);
+  SHOW("Successful preload of flash library program %d\n",n);
+
+  return;
+}
+
+/* Show the preloaded tape's name and type in the emulator status area */
+static void tapeshowfile(void)
+{
+  uint8_t mzstr[25];
+
   // Update the preloaded tape name in the emulator status area. Note
   // this is the name stored in the header, NOT the actual file name on
   // the SD card.
 
+  uint8_t *status=tapestatusarea();
   uint8_t spos=EMULINE1;
   // spos: EMULINE0 = start of status area line 0, EMULINE1 = line 1 etc.
 
-  memset(mzemustatus+EMULINE1,0x00,40); // Blank line
+  memset(status+EMULINE1,0x00,40); // Blank line
   ascii2mzdisplay("Next file is: ",mzstr);
   for (uint8_t i=0; i<14; i++) // Can't use strlen as space is 0x00!
-    mzemustatus[spos++]=mzstr[i];
+    status[spos++]=mzstr[i];
 
   // Tape name terminates with 0x0d or is 17 characters long
   // Stored in header[1] to header[17] - update status area with this
   // Note - needs converting from MZ 'ASCCI' to MZ display codes
   uint8_t hpos=1;
   while ((header[hpos] != 0x0d) && (hpos <= 17))
-    mzemustatus[spos++]=mzascii2mzdisplay(header[hpos++]);
+    status[spos++]=mzascii2mzdisplay(header[hpos++]);
 
   // Update the preloaded tape type in the emulator status area.
-  memset(mzemustatus+EMULINE2,0x00,40); // Blank line
+  memset(status+EMULINE2,0x00,40); // Blank line
   spos=EMULINE2;
   ascii2mzdisplay("File type is: ",mzstr);
   for (uint8_t i=0; i<14; i++) // Can't use strlen as space is 0x00!
-    mzemustatus[spos++]=mzstr[i];
+    status[spos++]=mzstr[i];
 
   // Type of tape is stored in the header
   // 0x01 = machine code, 0x02 = language (BASIC,Pascal etc.), 0x03 = data
@@ -335,95 +1344,528 @@ int16_t tapeloader(int16_t n)
   switch (header[0]) {
     case 0x01: ascii2mzdisplay("Machine code",mzstr);
                for (uint8_t i=0; i<12; i++)
-                 mzemustatus[spos++]=mzstr[i];
+                 status[spos++]=mzstr[i];
                break;
     case 0x02: ascii2mzdisplay("Sharp BASIC etc.",mzstr);
                for (uint8_t i=0; i<16; i++)
-                 mzemustatus[spos++]=mzstr[i];
+                 status[spos++]=mzstr[i];
                break;
     case 0x03: ascii2mzdisplay("Data file",mzstr);
                for (uint8_t i=0; i<9; i++)
-                 mzemustatus[spos++]=mzstr[i];
+                 status[spos++]=mzstr[i];
                break;
     case 0x04: ascii2mzdisplay("Zen source",mzstr);
                for (uint8_t i=0; i<10; i++)
-                 mzemustatus[spos++]=mzstr[i];
+                 status[spos++]=mzstr[i];
                break;
     case 0x06: ascii2mzdisplay("Chalkwell BASIC",mzstr);
                for (uint8_t i=0; i<15; i++)
-                 mzemustatus[spos++]=mzstr[i];
+                 status[spos++]=mzstr[i];
                break;
     case 0x20: ascii2mzdisplay("Pico MZ-80K memory dump",mzstr);
                for (uint8_t i=0; i<23; i++)
-                 mzemustatus[spos++]=mzstr[i];
+                 status[spos++]=mzstr[i];
                break;
     default:   ascii2mzdisplay("Unknown file type",mzstr);
                for (uint8_t i=0; i<17; i++)
-                 mzemustatus[spos++]=mzstr[i];
+                 status[spos++]=mzstr[i];
                break;
   }
 
-  // We've read the tape successfully if we get here
-  SHOW("Successful preload of %s\n",fno.fname);
-  f_close(&fp);
+#ifdef USBDIAGOUTPUT
+  uint32_t hits,misses;
+  sd_cache_stats(&hits,&misses);
+  SHOW("sd card sector cache: %d hits, %d misses\n",hits,misses);
+#endif
+
+  return;
+}
+
+/* Show a subdirectory as the next 'file' in the emulator status area */
+static void tapeshowdir(int16_t n)
+{
+  uint8_t *status=tapestatusarea();
+  uint8_t spos=EMULINE1;
+  uint8_t mzstr[30];
+  uint8_t hpos=0;
+
+  memset(status+EMULINE1,0x00,40); // Blank line
+  ascii2mzdisplay("Next file is: ",mzstr);
+  for (uint8_t i=0; i<14; i++) // Can't use strlen as space is 0x00!
+    status[spos++]=mzstr[i];
+  while ((hpos < 17) && (tapeindex[n].hname[hpos] != 0x0d))
+    status[spos++]=mzascii2mzdisplay(tapeindex[n].hname[hpos++]);
+
+  memset(status+EMULINE2,0x00,40); // Blank line
+  spos=EMULINE2;
+  ascii2mzdisplay("File type is: Directory (F3)",mzstr);
+  for (uint8_t i=0; i<28; i++)
+    status[spos++]=mzstr[i];
+
+  return;
+}
+
+/* Preload the nth file on the tape - sd card worker job. A tape in    */
+/* flash or the tape cache is preloaded at once. A file on the sd card */
+/* is opened, mapped a cluster per call and then has its header read,  */
+/* so a long FAT chain never holds up the Z80.                         */
+static uint8_t tapeloadjob(int16_t n, bool first)
+{
+  if (first) {
+    // The index can have changed since the file was chosen
+    if (n >= tapecount) {
+      /* We're at the end of the tape */
+      /* Return with no change to the preloaded file */
+      SHOW("End of tape at file %d\n",n);
+    }
+    else if (tapeindex[n].isdir)
+      SHOW("Tape file %d is a directory\n",n);
+    else if (tapeindex[n].inflash) {
+      tapeflashpreload(n);
+      tapeshowfile();
+      return(SDIODONE);
+    }
+    else if (tapecachepreload(n)) {
+      tapeshowfile();
+      return(SDIODONE);
+    }
+    else if (tapefileopen(n))
+      return(SDIOMORE);
+  }
+  else if (!tapefilemap())
+    return(SDIOMORE);
+  else if (tapefilepreload()) {
+    tapeshowfile();
+    return(SDIODONE);
+  }
+
+  mzsdiostatus("Tape preload failed");
+  return(SDIOFAILED);
+}
+
+/* Preload a tape file header ready for LOAD, without waiting for the */
+/* sd card worker. The body is streamed from the sd card, or read     */
+/* from flash, by cread() as the tape is read.                        */
+int16_t tapeloader(int16_t n)
+{
+  uint8_t result;
+
+  // If we're passed a number less than 0, use 0 (first file).
+  if (n < 0) 
+    n=0;
+
+  result=tapeloadjob(n,true);
+  while (result == SDIOMORE)
+    result=tapeloadjob(n,false);
+
+  return((result == SDIODONE) ? n : -1);
+}
+
+/* Choose the nth file on the tape as the next one to LOAD - F1 / F2. */
+/* The tape index says at once whether there is an nth file, so the   */
+/* file itself is preloaded by the sd card worker. Returns n, or -1   */
+/* if there is no nth file.                                           */
+int16_t tapeselect(int16_t n)
+{
+  // If we're passed a number less than 0, use 0 (first file).
+  if (n < 0)
+    n=0;
+
+  if (n >= tapecount) {
+    /* We're at the end of the tape */
+    /* Return with no change to the preloaded file */
+    SHOW("End of tape at file %d\n",n);
+    return(-1);
+  }
+
+  // A subdirectory is only shown - F3 opens it
+  if (tapeindex[n].isdir) {
+    tapedirsel=n;
+    tapeshowdir(n);
+    return(n);
+  }
+  tapedirsel=-1;
+
+  if (!mzsdiorequest(tapeloadjob,n))
+    return(-1);
+
+  return(n);
+}
+
+/* Change directory, and rebuild the tape index for the new one - sd */
+/* card worker job                                                   */
+static uint8_t tapechdirjob(int16_t n, bool first)
+{
+  FRESULT res;
+  uint8_t *sfn=tapeindex[n].sfn;
+  uint8_t *last;
+  uint8_t message[41];
+
+  tapedirbusy=false;
+  if ((strcmp(sfn,"..") != 0) &&
+      (strlen(tapedir)+strlen(sfn)+2 > TAPEDIRMAX)) {
+    SHOW("Directory %s/%s is too deep\n",tapedir,sfn);
+    mzsdiostatus("Directory too deep");
+    return(SDIOFAILED);
+  }
+
+  tapewritefinish();       // A SAVE is finished in its own directory
+  res=f_chdir(sfn);
+  if (res != FR_OK) {
+    SHOW("Error changing directory to %s, status is %d\n",sfn,res);
+    mzsdiostatus("Directory change failed");
+    return(SDIOFAILED);
+  }
+
+  // Keep the path in step
+  if (strcmp(sfn,"..") == 0) {
+    last=strrchr(tapedir,'/');
+    if (last == tapedir) last++;   // Back to the root
+    *last='\0';
+  }
+  else {
+    if (tapedir[1] != '\0') strcat(tapedir,"/");
+    strcat(tapedir,sfn);
+  }
+
+  memset(tapestatusarea()+EMULINE1,0x00,80); // Blank next file lines
+  if (tapeindexbuild() != FR_OK) {
+    mzsdiostatus("Directory read failed");
+    return(SDIOFAILED);
+  }
+  snprintf(message,sizeof(message),"Directory %s",tapedir);
+  mzsdiostatus(message);
+  if (tapecatshown) {      // Catalogue moves to the new directory
+    tapecatcursor=0;
+    tapecatfind[0]='\0';
+    tapecatdraw();
+  }
+
+  return(SDIODONE);
+}
+
+/* Queue the change to the selected directory. Returns false, with */
+/* "sd card busy" shown, if it could not be queued.                 */
+static bool tapequeuechdir(void)
+{
+  if (tapedirbusy) {
+    mzsdiostatus("sd card busy");
+    return(false);
+  }
+  if (!mzsdiorequest(tapechdirjob,tapedirsel)) return(false);
+  tapedirbusy=true;
+  tapedirsel=-1;
+
+  return(true);
+}
+
+/* Open the subdirectory shown by F1 / F2 - F3. Returns false if a */
+/* file, not a subdirectory, is shown.                             */
+bool tapeopendir(void)
+{
+  if (tapedirsel < 0) return(false);
+
+  tapequeuechdir();
+
+  return(true);
+}
+
+/* Draw the tape catalogue - the directory, the position of the cursor */
+/* and any name typed on status line 0, then a page of the tape index  */
+/* in two columns on lines 1 to 4                                      */
+static void tapecatdraw(void)
+{
+  uint8_t line[41];
+  uint8_t mzstr[41];
+  uint8_t len,spos,hpos;
+  int16_t page=tapecatcursor-(tapecatcursor%TAPECATPAGE);
+  int16_t n;
+  tapeentry *te;
+
+  memset(mzemustatus,0x00,EMUSSIZE);    // Blank status area
+
+  if (tapecount == 0)
+    snprintf(line,sizeof(line),"%.24s - no files",tapedir);
+  else
+    snprintf(line,sizeof(line),"%.16s %d/%d %s%s",tapedir,tapecatcursor+1,
+             tapecount,(tapecatfind[0] != '\0') ? "Find:" : "",tapecatfind);
+  len=strlen(line);
+  ascii2mzdisplay(line,mzstr);
+  memcpy(mzemustatus+EMULINE0,mzstr,len);
+
+  for (uint8_t i=0;i<TAPECATPAGE;i++) {
+    n=page+i;
+    if (n >= tapecount) break;
+    te=&tapeindex[n];
+
+    // Down the first column, then the second - 20 characters each
+    spos=EMULINE1+(i%TAPECATROWS)*40+(i/TAPECATROWS)*20;
+    if (n == tapecatcursor) {
+      ascii2mzdisplay(">",mzstr);
+      mzemustatus[spos]=mzstr[0];
+    }
+    ++spos;
+    hpos=0;
+    while ((hpos < 17) && (te->hname[hpos] != 0x0d))
+      mzemustatus[spos++]=mzascii2mzdisplay(te->hname[hpos++]);
+    if (te->isdir) {
+      ascii2mzdisplay("/",mzstr);
+      mzemustatus[spos]=mzstr[0];
+    }
+  }
+
+  return;
+}
+
+/* Find the first entry in the tape index whose name starts with the */
+/* name typed. Returns the cursor position unchanged if there isn't  */
+/* one.                                                              */
+static int16_t tapecatsearch(void)
+{
+  uint8_t len=strlen(tapecatfind);
+  uint8_t k;
+
+  for (int16_t n=0;n<tapecount;n++) {
+    for (k=0;k<len;k++)
+      if ((tapeindex[n].hname[k] == 0x0d) ||
+          (tapeindex[n].hname[k] != tapecatfind[k])) break;
+    if (k == len) return(n);
+  }
+
+  return(tapecatcursor);
+}
+
+/* Show the tape catalogue - Tab */
+void tapecatopen(void)
+{
+  if (tapecatshown) return;
+
+  memcpy(tapecatsaved,mzemustatus,EMUSSIZE);
+  tapecatshown=true;
+  if (tapecatcursor >= tapecount) tapecatcursor=0;
+  tapecatfind[0]='\0';
+  tapecatdraw();
+
+  return;
+}
+
+/* Put the status lines back */
+static void tapecatclose(void)
+{
+  memcpy(mzemustatus,tapecatsaved,EMUSSIZE);
+  tapecatshown=false;
+
+  return;
+}
+
+/* Is the tape catalogue shown? */
+bool tapecatactive(void)
+{
+  return(tapecatshown);
+}
+
+/* Deal with a key pressed while the tape catalogue is shown - one of   */
+/* the CATKEY codes, or a printable ASCII character to add to the name  */
+/* being found. Enter preloads the file under the cursor and closes the */
+/* catalogue, or opens the directory under it. Returns the tape file    */
+/* number F1 carries on from when a file has been chosen or a change of */
+/* directory queued, otherwise -1.                                      */
+int16_t tapecatkey(uint8_t key)
+{
+  int16_t next=tapecatcursor;
+  uint8_t len=strlen(tapecatfind);
+  bool moved=true;
+
+  switch (key) {
+    case CATKEYUP:    next-=1;
+                      break;
+    case CATKEYDOWN:  next+=1;
+                      break;
+    case CATKEYLEFT:  next-=TAPECATROWS;
+                      break;
+    case CATKEYRIGHT: next+=TAPECATROWS;
+                      break;
+    case CATKEYPGUP:  next-=TAPECATPAGE;
+                      break;
+    case CATKEYPGDN:  next+=TAPECATPAGE;
+                      break;
+    case CATKEYEXIT:  tapecatclose();
+                      return(-1);
+    case CATKEYENTER: if (tapecount == 0) return(-1);
+                      if (tapeindex[tapecatcursor].isdir) {
+                        tapedirsel=tapecatcursor;
+                        return(tapequeuechdir() ? 0 : -1);
+                      }
+                      tapecatclose();
+                      if (tapeselect(tapecatcursor) < 0) return(-1);
+                      return(tapecatcursor+1);
+    case CATKEYDEL:   if (len > 0) tapecatfind[len-1]='\0';
+                      next=tapecatsearch();
+                      moved=false;
+                      break;
+    default:          if ((key < 0x20) || (key > 0x7e)) return(-1);
+                      if (len < TAPECATFIND) {
+                        tapecatfind[len++]=key;
+                        tapecatfind[len]='\0';
+                      }
+                      next=tapecatsearch();
+                      moved=false;
+                      break;
+  }
 
-  return(n);     /* Return the file number loaded - matches requested */
+  // Moving the cursor starts a new search
+  if (moved) tapecatfind[0]='\0';
+  if (next >= tapecount) next=tapecount-1;
+  if (next < 0) next=0;
+  tapecatcursor=next;
+  tapecatdraw();
+
+  return(-1);
 }
 
-/* Write a new file to sd card 'tape'                             */
-void tapewriter(void)
+/* Start writing a new file to sd card 'tape' - called by cwrite() */
+/* once the header has been received                                */
+static void tapewriteopen(void)
 {
   uint8_t sharpfilelen=0;
-  uint8_t sdfilename[22];  // sdfilename needs 1 more char than
-                           // the Sharp tape file name due to null
-                           // termination requirements
-                           // plus 4 characters for the .mzf extension
-  uint bw;                 // Number of bytes written to file
-  uint16_t i;              // Counts file body bytes written to sd card
   FRESULT res;
-  FIL fp;
 
-  SHOW("In tapewriter()\n");
+  SHOW("In tapewriteopen()\n");
   SHOW("Convert Sharp tape file name to sensible ASCII\n");
 
   // Sharp tape file name is up to 17 characters stored in header[1]
   // to header[17]. If less than 17 characters, name ends with 0x0D
 
   // Find each character of the Sharp tape file name and convert
-  // it into something safe for the sd card file name
+  // it into something safe for the sd card file name. tapewname
+  // needs 1 more char than the Sharp tape file name due to null
+  // termination requirements plus 4 characters for the .mzf extension
   while ((sharpfilelen < 17) && (header[sharpfilelen+1] != 0x0D)) {
-    sdfilename[sharpfilelen]=mzsafefilechar(header[sharpfilelen+1]);
+    tapewname[sharpfilelen]=mzsafefilechar(header[sharpfilelen+1]);
     ++sharpfilelen;
   }
 
   // Add .MZF and null terminate
-  sdfilename[sharpfilelen++]='.';
-  sdfilename[sharpfilelen++]='M';
-  sdfilename[sharpfilelen++]='Z';
-  sdfilename[sharpfilelen++]='F';
-  sdfilename[sharpfilelen]='\0';
+  tapewname[sharpfilelen++]='.';
+  tapewname[sharpfilelen++]='M';
+  tapewname[sharpfilelen++]='Z';
+  tapewname[sharpfilelen++]='F';
+  tapewname[sharpfilelen]='\0';
+
+  // The preloaded tape is replaced by the one being saved
+  tapewritefinish();
+  if (tapemode != TAPECLOSED) {
+    f_close(&tapefp);
+    tapemode=TAPECLOSED;
+  }
+  tapeimage=NULL;
+  tapecachestop();
 
   // Open a file on the sd card for writing. If it exists already
   // we simply overwrite it ... just as would happen on a tape.
-  res=f_open(&fp,sdfilename,FA_CREATE_ALWAYS|FA_WRITE);
+  res=f_open(&tapefp,tapewname,FA_CREATE_ALWAYS|FA_WRITE);
   if (res) {
-    SHOW("Error on file open for %s, status is %d\n",sdfilename,res);
+    SHOW("Error on file open for %s, status is %d\n",tapewname,res);
     return;
   }
+  tapemode=TAPEWRITE;
 
-  // Write the 128 byte header to the file
-  f_write(&fp, header, TAPEHEADERSIZE, &bw);
-  SHOW("%d header bytes written to %s\n",bw,sdfilename);
+  // Allocate the whole file in one contiguous block if the card has
+  // room for it. If not, FatFs allocates clusters as it goes.
+  if (f_expand(&tapefp,TAPEHEADERSIZE+(((header[19]<<8)&0xFF00)|header[18]),
+               1) != FR_OK)
+    SHOW("No contiguous space for %s\n",tapewname);
 
-  // Write the tape body to the file
-  uint16_t bodybytes=((header[19]<<8)&0xFF00)|header[18];
-  SHOW("bodybytes is\n",bodybytes);
-  for (i=0;i<bodybytes;i++)
-    f_write(&fp, &body[i], 1, &bw);
-  SHOW("%d file body bytes written to %s\n",i,sdfilename);
+  // The 128 byte header starts the first sector of the file. It is
+  // written to the sd card along with the start of the body.
+  memcpy(tapebuf[0],header,TAPEHEADERSIZE);
+  tapestagelen=0;
 
-  // Close the file and return
-  f_close(&fp);
+  return;
+}
+
+/* Write the sectors gathered in tapestage to the tape being saved */
+static void tapestageflush(void)
+{
+  uint bw;                 // Number of bytes written to file
+
+  if ((tapemode != TAPEWRITE) || (tapestagelen == 0)) return;
+  if ((f_write(&tapefp,tapestage,tapestagelen,&bw) != FR_OK) ||
+      (bw != tapestagelen))
+    SHOW("Error writing tape body to %s\n",tapewname);
+  tapestagelen=0;
+
+  return;
+}
+
+/* Add the first len bytes of one half of the window to the tape being */
+/* saved - always a whole sector, apart from at the end. They go to the */
+/* sd card once TAPESTAGESIZE bytes have been gathered, or at the end.  */
+static void tapebufwrite(uint8_t half, uint16_t len)
+{
+  if (tapemode != TAPEWRITE) return;
+  memcpy(&tapestage[tapestagelen],tapebuf[half],len);
+  tapestagelen+=len;
+  if ((tapestagelen == TAPESTAGESIZE) || (len < TAPEBUFSIZE))
+    tapestageflush();
+
+  return;
+}
+
+/* Close a finished SAVE. The tape becomes the preloaded tape, ready */
+/* to LOAD. Done by the sd card worker, or at once if the tape is     */
+/* needed before the worker gets to it.                               */
+static void tapewritefinish(void)
+{
+  FRESULT res;
+  uint8_t message[40];
+
+  if (tapemode != TAPECLOSING) return;
+  f_close(&tapefp);
+  tapemode=TAPECLOSED;
+
+  // Add it to the tape index and reopen it for reading
+  tapeindexupdate(tapewname);
+  res=f_open(&tapefp,tapewname,FA_READ|FA_OPEN_EXISTING);
+  if (res == FR_OK) {
+    tapemode=TAPEREAD;
+    tapebase=0;
+    tapepacked=false;
+    tapelinkmap(&tapefp,tapeclmt,TAPECLMTSIZE);
+  }
+  tapehchk=mzf_checksum(header,TAPEHEADERSIZE);
+  SHOW("%s written to sd card\n",tapewname);
+  snprintf(message,sizeof(message),"Saved %s",tapewname);
+  mzsdiostatus(message);
+
+  return;
+}
+
+/* Close a finished SAVE - sd card worker job */
+static uint8_t tapefinishjob(int16_t unused, bool first)
+{
+  tapewritefinish();
+  return(SDIODONE);
+}
+
+/* Finish writing a file to sd card 'tape'. A good tape is closed by */
+/* the sd card worker. A bad one is removed.                         */
+static void tapewriteclose(bool ok)
+{
+  if (tapemode != TAPEWRITE) return;
+
+  if (ok) {
+    tapestageflush();              // Sectors still gathered
+    tapemode=TAPECLOSING;
+    if (!mzsdiorequest(tapefinishjob,0))
+      tapewritefinish();           // Queue full - do it now
+    return;
+  }
+
+  f_close(&tapefp);
+  tapemode=TAPECLOSED;
+  SHOW("Removing incomplete tape %s\n",tapewname);
+  f_unlink(tapewname);
 
   return;
 }
@@ -433,6 +1875,10 @@ void tapewriter(void)
 /* BREAK key is pressed to abort.                */
 void reset_tape(void)
 {
+  // Abandon any tape being saved
+  if (tapemode == TAPEWRITE)
+    tapewriteclose(false);
+
   crstate=0;
   cwstate=0;
   /* Also reset the motor and sense flags - not sure if this
@@ -443,27 +1889,22 @@ void reset_tape(void)
   return;
 }
 
-/* Read an MZ-80K format tape one bit at a time */
-/* Pseudo finite state machine implementation   */
-/* If the header and body are read successfully */
-/* at the first attempt, the read process ends  */
-/* and the second copy is not read. This impl.  */
-/* assumes that the first read is ALWAYS good,  */
-/* as we're using .mzf files rather than a real */
-/* cassette tape.                               */
+/* Read an MZ-80K format tape one bit at a time. The tape is sent */
+/* by stepping through tapeprog[] - each step is a run of short or */
+/* long pulses, or a run of bytes, each sent as a long pulse then  */
+/* 8 bits, msb first. If the header and body are read successfully */
+/* at the first attempt, the read process ends and the second copy */
+/* is not read. This impl. assumes that the first read is ALWAYS   */
+/* good, as we're using .mzf files rather than a real cassette.    */
 uint8_t cread(void)
 {
-                             // Used to calculate the bit to output from tape
-  uint8_t bitshift;          // to the MZ-80K when reading the header or body
-  static uint16_t chkbits;   // Tracks number of long pulses sent in the header
-                             // or body to enable the checksum to be calculated
-                             // MUST be a 16 bit unsigned value
-  static uint16_t bodybytes; // Length of tape body as declared in the header
-  static bool longsent;      // Tracks if a long pulse has been sent before 
-                             // each new byte of the header, checksums and body
-  static uint8_t checksum[2];// Stores the calculated checksum
   static uint8_t hilo=0;     // Used for the 1 -> tape bit read -> 0 logic
-  static uint32_t secbits;   // Tracks where we are in the current tape section
+  static uint16_t stepn;     // Pulses or bytes sent in the current step
+  static uint8_t bitn;       // Next pulse of the current byte: 0 is the
+                             // long pulse before it, 1-8 are its bits
+  static uint16_t bodybytes; // Length of tape body as declared in the header
+  const tapestep *step;
+  uint8_t pulse;
 
   if (cmotor==0) {
     if (crstate==0) {
@@ -486,218 +1927,54 @@ uint8_t cread(void)
   hilo=(hilo+1)%3;           // Sequence is 1, followed by the tape bit (0/1),
   if (hilo<2) return(hilo);  // followed by 0 until end of tape is reached
 
-  // Initialise local statics if state is 0, transition to state 1
+  // Start at the first step of the program. The body length is
+  // taken from the header - header[19] (msb) and header[18] (lsb).
   if (crstate==0) {
-    secbits=0;
-    chkbits=0;
-    longsent=false;
-    crstate=1;
-    // We don't return here - always fall through to state 1 immediately
-  }
- 
-  /* Header preamble - bgap, btm, l - state 1 */
-  // Note - 22,000 pulses in a real bgap, but anything > 100 will work
-  // when a tape is being read (writing is different!) 
-  if (crstate==1) {
-    if (secbits<RBGAP_L) {
-      ++secbits;
-      return(SHORTPULSE);
-    }
-    if (secbits<RBGAP_L+(BTM_L/2)) {  /* First half of btm is long pulses */
-      ++secbits;
-      return(LONGPULSE);
-    }
-    if (secbits<RBGAP_L+BTM_L) {
-      ++secbits;
-      return(SHORTPULSE);
-    }
-    secbits=0;
-    crstate=2;
-    return(LONGPULSE);
-  }
-
-  /* First copy of the header */
-  if (crstate==2) {
-    if (secbits<HDR_L) {
-      /* One LONGPULSE is sent before every byte of the header */
-      if (((secbits%8)==0) && (longsent==false)) {
-        /* Note - we don't increment secbits here */
-        longsent=true;
-        return(LONGPULSE);
-      }
-      longsent=false;
-      /* Bytes are sent starting with bit 7 (msb) */
-      bitshift=secbits%8;
-      if (((header[secbits++/8]<<bitshift)&0x80) == 0x80) {
-        ++chkbits; // Increment the long pulse count for calculating chkh
-        return(LONGPULSE);
-      }
-      return(SHORTPULSE);
-    }
-    /* At the end of the header, move onto checksum state (3) */
-    secbits=0;
-    crstate=3;
-  }
-
-  /* Header checksum - state 3 */
-  if (crstate==3) {
-    if (secbits<CHK_L) {
-      if ((secbits==0)&&(chkbits>0)) {
-        // Need to calculate the header checksum
-        // Note as chkbits is a uint16_t, we don't need to do modulo 2^16
-        // as this will automatically be taken care of for us
-        checksum[0]=(chkbits>>8)&0xFF; /* MSB of the checksum */
-        checksum[1]=chkbits&0xFF;      /* LSB of the checksum */
-        SHOW("Header checksum is 0x%04x 0x%02x 0x%02x\n",chkbits,checksum[0],checksum[1]);
-        // Reset chkbits for the next time a checksum is calculated
-        chkbits=0;
-      }
-      if (((secbits % 8) == 0) && (longsent == false)) {
-        /* Note - we don't increment secbits here */
-        longsent = true;
-        return(LONGPULSE);
-      }
-      /* Reset the longsent flag */
-      longsent = false;
-      /* Bytes are sent starting with the MSB */
-      bitshift=secbits%8;
-      if (((checksum[secbits++/8]<<bitshift)&0x80) == 0x80) {
-        return(LONGPULSE);
-      }
-      return(SHORTPULSE);
-    }
-    /* At the end of the checksum */
-    /* Note - current assumption is that this is correct */
-    /* Reasonable - as this isn't a real cassette tape */
-    /* Saves a little time and complexity */
-    secbits=0;
-    crstate=7; 
-  }
-
-  /* States 4,5 and 6 are only required if the header checksum failed */
-  /* The emulator uses .mzf files and assumes the copy of the header */
-  /* is not required, but these states are reserved in case the ability */
-  /* to use .wav tape copies is ever implemented */
-  /* State 4 - one long, 256 short pulses */
-  /* State 5 - header copy */
-  /* State 6 - header checksum copy */
-
-  /* We now have a long pulse, short gap, short tape mark and long pulse */
-  /* before we finally get to the tape body */
-
-  if (crstate==7) {
-    if (secbits<L_L) {
-      ++secbits;
-      return(LONGPULSE);
-    }
-    if (secbits<L_L+RSGAP_L) {
-      ++secbits;
-      return(SHORTPULSE);
-    }
-    if (secbits<L_L+RSGAP_L+(STM_L/2)) {
-      ++secbits;
-      return(LONGPULSE);
-    }
-    if (secbits<L_L+RSGAP_L+STM_L) {
-      ++secbits;
-      return(SHORTPULSE);
-    }
-    if (secbits<L_L+RSGAP_L+STM_L+L_L) {
-      ++secbits;
-      return(LONGPULSE);
-    }
-    secbits=0;
-    /* Tape body - length is calculated from the values stored by the header */
-    /* in memory locations 0x1103 and 0x1102 from the 20th & 19th values     */
-    /* found in the header - i.e. header[19] (msb) and header[18] (lsb).     */
     bodybytes=((header[19]<<8)&0xFF00)|header[18];
     SHOW("Body length is 0x%04x (%d) bytes\n",bodybytes,bodybytes);
-    SHOW("Transition to state 8 - program data\n");
-    crstate=8;
+    tapebufrewind();         // First two parts of the body to the window
+    stepn=0;
+    bitn=0;
+    crstate=1;
   }
-
-  /* Process the tape body - state 8 */
-  if (crstate==8) {
-    if (secbits<(bodybytes*8)) {     // 1 byte = 8 bits to transmit
-      /* One LONGPULSE is sent before every byte of the header */
-      if (((secbits%8)==0) && (longsent==false)) {
-        /* Note - we don't increment secbits here */
-        longsent=true;
-        mzspinny(1); //Increment tape counter
-        return(LONGPULSE);
-      }
-      longsent=false;
-      /* Bytes are sent starting with bit 7 (msb) */
-      bitshift=secbits%8;
-      if (((body[secbits++/8]<<bitshift)&0x80) == 0x80) {
-        ++chkbits; // Increment the long pulse count for calculating chkb
-        return(LONGPULSE);
-      }
-      return(SHORTPULSE);
-    }
-    /* At the end of the body, move onto checksum state (9) */
-    SHOW("Transition to state 9 - program checksum\n");
-    SHOW("%d bits processed\n",secbits);
-    SHOW("%d bytes processed\n",secbits/8);
-    secbits=0;
-    crstate=9;
-  }
-
-  /* Body checksum - state 9 */
-  if (crstate==9) {
-    if (secbits<CHK_L) {
-      if ((secbits==0)&&(chkbits>0)) {
-        // Need to calculate the body checksum
-        // Note as chkbits is a uint16_t, we don't need to do modulo 2^16
-        // as this will automatically be taken care of for us
-        checksum[0]=(chkbits>>8)&0xFF; /* MSB of the checksum */
-        checksum[1]=chkbits&0xFF;      /* LSB of the checksum */
-        SHOW("Body checksum is 0x%02x%02x\n",checksum[0],checksum[1]);
-        // Reset chkbits for the next time a checksum is calculated
-        chkbits=0;
-      }
-      if (((secbits % 8) == 0) && (longsent == false)) {
-        /* Note - we don't increment secbits here */
-        longsent = true;
-        return(LONGPULSE);
-      }
-      /* Reset the longsent flag */
-      longsent = false;
-      /* Bytes are sent starting with the MSB */
-      bitshift=secbits%8;
-      if (((checksum[secbits++/8]<<bitshift)&0x80) == 0x80) {
-        return(LONGPULSE);
-      }
-      return(SHORTPULSE);
-    }
-    /* At the end of the checksum stop */
-    /* Assumes copy of program data is not needed */
-    SHOW("Transition to state 13 - stop\n");
-    secbits=0;
-    crstate=13; 
-  }
-
-  /* States 10,11 and 12 are only needed if the program body has failed */
-  /* to checksum correctly, so are not required for .mzf files */
-  /* State 10 - a long pulse followed by 256 short */
-  /* State 11 - a copy of the body */
-  /* State 12 - a copy of the body checksum */
-
-  if (crstate==13) {
-  /* At end of body checksum, reset tape state, send final stop bit */
-      hilo=0;
-      reset_tape();
-      SHOW("Final stop bit sent\n");
-      return(LONGPULSE);
+  step=&tapeprog[crstate-1];
+
+  switch (step->kind) {
+    case TSHORT: pulse=SHORTPULSE;
+                 break;
+    case TLONG:  pulse=LONGPULSE;
+                 break;
+    case TEND:   // At end of body checksum, reset tape state,
+                 // send final stop bit
+                 hilo=0;
+                 reset_tape();
+                 SHOW("Final stop bit sent\n");
+                 return(LONGPULSE);
+    default:     // Header, body or checksum byte
+                 if (bitn==0) {
+                   if (step->kind==TBODY) {
+                     mzspinny(1); //Increment tape counter
+                     /* Starting a new half of the window - refill the */
+                     /* other one with the sector after it             */
+                     if (((stepn+TAPEHEADERSIZE)%TAPEBUFSIZE) == 0)
+                       tapebufread(((stepn+TAPEHEADERSIZE)/TAPEBUFSIZE+1)&1);
+                   }
+                   pulse=LONGPULSE;
+                 }
+                 else
+                   pulse=(tapebyte(step->kind,stepn)>>(8-bitn))&1;
+                 if ((++bitn) < 9) return(pulse);
+                 bitn=0;
+                 break;
   }
 
-  /* Catch any errors - shouldn't happen, but ...        */
-  SHOW("Error in cread() - unknown state %d\n",crstate);
-  /* Reset hilo to 0, reset state */
-  hilo=0;
-  reset_tape();
+  // Move on to the next step at the end of this one
+  if ((++stepn) >= ((step->kind==TBODY) ? bodybytes : step->count)) {
+    stepn=0;
+    ++crstate;
+  }
 
-  return(LONGPULSE);
+  return(pulse);
 }
 
 /* Write an MZ-80K format tape one bit at a time */
@@ -711,12 +1988,15 @@ void cwrite(uint8_t nextbit)
                              // each new byte of the header, checksums and body
   static uint32_t secbits;   // Tracks where we are in the current tape section
   static int32_t low,high;   // Count of low and high bits received
-  static absolute_time_t hightime;  // Timestamp of last high bit received
-  static absolute_time_t lowtime;   // Timestamp of last low bit received
+  // Pulse widths are measured in Z80 T-states rather than real time,
+  // so they are the same however fast the emulator is running
+  static uint32_t hightime;  // T-state count at last high bit received
+  static uint32_t lowtime;   // T-state count at last low bit received
   static uint16_t chkbits;   // Tracks number of long pulses recvd in the header
                              // or body to enable the checksum to be calculated
                              // MUST be a 16 bit unsigned value
   static uint8_t checksum[2];// Stores the calculated checksum
+  static uint8_t *bodybyte;  // Byte of the tape body being received
   uint8_t pulse;             // Current header or body pulse: 0=low, 1=high
   
   if (cwstate==0) {
@@ -728,10 +2008,11 @@ void cwrite(uint8_t nextbit)
                              // emulator, it starts  to read any preloaded 
                              // tape and then stops, before starting to write
                              // to it. Hence the need for this statement!
+    tapewriteclose(false);   // Abandon any earlier save that didn't finish
     secbits=0;               // Section (state) bit count
     low=0;                   // low pulse counter
     high=0;                  // high pulse counter
-    hightime=get_absolute_time(); // Timestamp of first high bit received
+    hightime=mzcpu.cyc;       // T-state count at first high bit received
     cwstate=1;                    // Process the preamble bits in state 1.
     return;                  
   }
@@ -739,15 +2020,15 @@ void cwrite(uint8_t nextbit)
   /* State 1 - tape header preamble */
   if (cwstate==1) {
     if (nextbit==0) {
-      lowtime=get_absolute_time();
-      if (absolute_time_diff_us(hightime,lowtime) < READPT)
+      lowtime=mzcpu.cyc;
+      if ((uint32_t)(lowtime-hightime) < READPT_T)
         ++low;                   // We have a low (short) pulse
       else
         ++high;                  // We have a high (long) pulse
       ++secbits;                 // Increment pulses counted
     }
     else {
-      hightime=get_absolute_time();
+      hightime=mzcpu.cyc;
     }
     /* Check that we have received 22,040 low pulses and 41 high pulses */
     /* when the total received is 22,081 - ie, after WBGAP_L+BTM_L+L_L  */
@@ -772,8 +2053,8 @@ void cwrite(uint8_t nextbit)
   /* State 2 - header */
   if (cwstate==2) {
     if (nextbit==0) {
-      lowtime=get_absolute_time();
-      if (absolute_time_diff_us(hightime,lowtime) < READPT)
+      lowtime=mzcpu.cyc;
+      if ((uint32_t)(lowtime-hightime) < READPT_T)
         pulse=0;                 // We have a low (short) pulse
       else 
         pulse=1;                 // We have a high (long) pulse
@@ -792,7 +2073,7 @@ void cwrite(uint8_t nextbit)
       }
     }
     else {
-      hightime=get_absolute_time();
+      hightime=mzcpu.cyc;
     }
     /* Check to see if we're at the end of the header */
     if (secbits==HDR_L) {
@@ -806,8 +2087,8 @@ void cwrite(uint8_t nextbit)
   /* State 3 - header checksum */
   if (cwstate==3) {
     if (nextbit==0) {
-      lowtime=get_absolute_time();
-      if (absolute_time_diff_us(hightime,lowtime) < READPT)
+      lowtime=mzcpu.cyc;
+      if ((uint32_t)(lowtime-hightime) < READPT_T)
         pulse=0;                 // We have a low (short) pulse
       else 
         pulse=1;                 // We have a high (long) pulse
@@ -825,7 +2106,7 @@ void cwrite(uint8_t nextbit)
       }
     }
     else {
-      hightime=get_absolute_time();
+      hightime=mzcpu.cyc;
     }
     /* Check to see if we're at the end of the checksum */
     if (secbits==CHK_L) {
@@ -835,6 +2116,7 @@ void cwrite(uint8_t nextbit)
         SHOW("Header checksum is bad ... carrying on anyway\n");
       bodybytes=((header[19]<<8)&0xFF00)|header[18]; // Needed for state 8
       SHOW("Body length is 0x%04x\n",bodybytes);
+      tapewriteopen();           // Create the file and write the header
       cwstate=4;
       chkbits=0;
       secbits=0;
@@ -867,8 +2149,8 @@ void cwrite(uint8_t nextbit)
   /* State 8 - file body */
   if (cwstate==8) {
     if (nextbit==0) {
-      lowtime=get_absolute_time();
-      if (absolute_time_diff_us(hightime,lowtime) < READPT)
+      lowtime=mzcpu.cyc;
+      if ((uint32_t)(lowtime-hightime) < READPT_T)
         pulse=0;                 // We have a low (short) pulse
       else 
         pulse=1;                 // We have a high (long) pulse
@@ -876,19 +2158,26 @@ void cwrite(uint8_t nextbit)
         // This is the long pulse that preceeds every byte of the body,
         // so we ignore it and blank the next byte of the body ready
         // for the next 8 bits
-        body[secbits/8]=0x00;
+        bodybyte=&TAPEBUFBYTE(secbits/8);
+        *bodybyte=0x00;
         longread=true;
         mzspinny(1); //Increment tape counter
       }
       else {
         longread=false;    // Reset for next byte
-        body[secbits/8]=(body[secbits/8]<<1)|pulse; // order is msb first 
+        *bodybyte=(*bodybyte<<1)|pulse; // order is msb first 
         ++secbits;         // Increment data pulses counted
         chkbits += pulse;  // If pulse was long, increment chkbits count
+        // Pass each half of the window on to be written as it fills. The
+        // time taken doesn't matter - pulses are timed in T-states.
+        if ((secbits%8 == 0) &&
+            (((secbits/8+TAPEHEADERSIZE)%TAPEBUFSIZE) == 0))
+          tapebufwrite(((secbits/8+TAPEHEADERSIZE)/TAPEBUFSIZE-1)&1,
+                       TAPEBUFSIZE);
       }
     }
     else {
-      hightime=get_absolute_time();
+      hightime=mzcpu.cyc;
     }
     /* Check to see if we're at the end of the body */
     if (secbits==bodybytes*8) {
@@ -902,8 +2191,8 @@ void cwrite(uint8_t nextbit)
   /* State 9 - file body checksum */
   if (cwstate==9) {
     if (nextbit==0) {
-      lowtime=get_absolute_time();
-      if (absolute_time_diff_us(hightime,lowtime) < READPT)
+      lowtime=mzcpu.cyc;
+      if ((uint32_t)(lowtime-hightime) < READPT_T)
         pulse=0;                 // We have a low (short) pulse
       else 
         pulse=1;                 // We have a high (long) pulse
@@ -921,7 +2210,7 @@ void cwrite(uint8_t nextbit)
       }
     }
     else {
-      hightime=get_absolute_time();
+      hightime=mzcpu.cyc;
     }
     /* Check to see if we're at the end of the checksum */
     if (secbits==CHK_L) {
@@ -961,23 +2250,27 @@ void cwrite(uint8_t nextbit)
   /* State 13 - the last long pulse */
   if (cwstate==13) {
     if (nextbit==0) {
-      lowtime=get_absolute_time();
-      if (absolute_time_diff_us(hightime,lowtime) < READPT)
+      lowtime=mzcpu.cyc;
+      if ((uint32_t)(lowtime-hightime) < READPT_T)
         ++low;                   // We have a low (short) pulse
       else
         ++high;                  // We have a high (long) pulse
       ++secbits;                 // Increment pulses counted
     }
     else {
-      hightime=get_absolute_time();
+      hightime=mzcpu.cyc;
     }
     /* Check that we have received 1 high pulse */
     /* when the total received is 1 */
     if (secbits==L_L) { 
       if (high==L_L) {
         // All ok - finish write
-        SHOW("End of file reached ok - writing to sd card\n");
-        tapewriter();
+        SHOW("End of file reached ok - finishing sd card write\n");
+        // Write the rest of the file still in the window
+        if ((TAPEHEADERSIZE+bodybytes)%TAPEBUFSIZE)
+          tapebufwrite(((TAPEHEADERSIZE+bodybytes)/TAPEBUFSIZE)&1,
+                       (TAPEHEADERSIZE+bodybytes)%TAPEBUFSIZE);
+        tapewriteclose(true);
         SHOW("sd card written\n");
         cwstate=0;
         secbits=0;
@@ -986,6 +2279,7 @@ void cwrite(uint8_t nextbit)
       }
       else {
         SHOW("Error at end of file! %d %d %d\n",secbits,low,high);
+        tapewriteclose(false);
         cwstate=0;
         secbits=0;
         high=0;
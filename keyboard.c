@@ -201,6 +201,61 @@ void tuh_hid_umount_cb(uint8_t addr, uint8_t inst)
   return;
 }
 
+/* Convert a USB HID key press to a tape catalogue key while the */
+/* catalogue is shown                                            */
+static void mzhidcatkey(uint8_t usbk0)
+{
+  uint8_t key;
+  int16_t tftemp;                         // Temporary tape file variable
+
+  if ((usbk0 >= 0x04) && (usbk0 <= 0x1d))
+    key='A'+(usbk0-0x04);                 // A to Z
+  else if ((usbk0 >= 0x1e) && (usbk0 <= 0x26))
+    key='1'+(usbk0-0x1e);                 // 1 to 9
+  else {
+    switch (usbk0) {
+      case 0x00: memset(processkey,0xFF,KBDROWS); // Key up - clear buffer
+                 return;
+      case 0x27: key='0';
+                 break;
+      case 0x2c: key=' ';
+                 break;
+      case 0x2d: key='-';
+                 break;
+      case 0x37: key='.';
+                 break;
+      case 0x28: key=CATKEYENTER;         // Return - choose
+                 break;
+      case 0x2a: key=CATKEYDEL;           // Backspace
+                 break;
+      case 0x29:                          // Escape or Tab - close
+      case 0x2b: key=CATKEYEXIT;
+                 break;
+      case 0x4b: key=CATKEYPGUP;          // Page up
+                 break;
+      case 0x4e: key=CATKEYPGDN;          // Page down
+                 break;
+      case 0x4f: key=CATKEYRIGHT;         // Right arrow
+                 break;
+      case 0x50: key=CATKEYLEFT;          // Left arrow
+                 break;
+      case 0x51: key=CATKEYDOWN;          // Down arrow
+                 break;
+      case 0x52: key=CATKEYUP;            // Up arrow
+                 break;
+      default:   return;                  // Ignore other keys
+    }
+  }
+
+  // F1 carries on from a file or directory chosen
+  if ((tftemp=tapecatkey(key)) >= 0) {
+    tfno=tftemp;
+    tfwd=true;
+  }
+
+  return;
+}
+
 /* Real USB Keyboard - used by non-diagnostic version picomz-80k.uf2 */
 /* Convert USB HID key press to the MZ-80K keyboard map,             */
 /* then store in the processkey[] global (read on portB by the 8255) */
@@ -208,6 +263,12 @@ void mzhidmapkey(uint8_t usbk0, uint8_t modifier)
 {
   int16_t tftemp;                         // Temporary tape file variable
 
+  /* Keys go to the tape catalogue, not the MZ-80K, while it is shown */
+  if (tapecatactive()) {
+    mzhidcatkey(usbk0);
+    return;
+  }
+
   /* Unshifted USB keys */
   if (modifier == 0x00) {
     switch (usbk0) {
@@ -323,13 +384,13 @@ void mzhidmapkey(uint8_t usbk0, uint8_t modifier)
                    tfwd=true;
                    tfno++;
                  }
-                 tftemp=tapeloader(tfno);      
+                 tftemp=tapeselect(tfno);      
                  if (tftemp >= 0) {       // If not at end of tape, increment
                    ++tfno;                // the tape file number
                  }
                  else {                   // Otherwise step back 1 file
                    --tfno;                // and preload it to memory again
-                   tftemp=tapeloader(tfno);
+                   tftemp=tapeselect(tfno);
                  }
                  break;
       case 0x3b: //F2 - Not mapped to an MZ-80K key
@@ -340,33 +401,54 @@ void mzhidmapkey(uint8_t usbk0, uint8_t modifier)
                  if (tfno > 0) {          // Step back one file if not at
                    --tfno;                // first file on tape.
                  }
-                 tftemp=tapeloader(tfno); // Preload the file
+                 tftemp=tapeselect(tfno); // Preload the file
                  if (tfno < 0) {          // Oh - we're off the other end!!
                    tfno=0;                // Shouldn't happen ... but ...
-                   tfno=tapeloader(tfno);
+                   tfno=tapeselect(tfno);
                  }
                  break;
       case 0x3c: //F3 - Not mapped to an MZ-80K key
-                 mzspinny(0);             // Reset tape counter
+                 if (tapeopendir()) {     // Open the directory shown by
+                   tfno=0;                // F1/F2, starting at its first
+                   tfwd=true;             // file. If a file is shown,
+                 }                        // reset the tape counter.
+                 else
+                   mzspinny(0);
                  break;
       case 0x3d: //F4 - Not mapped to an MZ-80K key
                  memset(mzemustatus,0x00,EMUSSIZE); // Clear status area
                  break;
+      case 0x2b: //Tab - Not mapped to an MZ-80K key
+                 tapecatopen();           // Show the tape catalogue
+                 break;
                  
       case 0x3e: //F5 - Not mapped to an MZ-80K key
-                 uint16_t temp;
-                 temp=whitepix;           // Reverse video
-                 whitepix=blackpix;
-                 blackpix=temp;
+                 mzreversevideo();        // Reverse video
+                 break;
+      case 0x3f: //F6 - Not mapped to an MZ-80K key
+                 vgalatch=!vgalatch;      // Frame consistent VRAM on/off
+                 break;
+      case 0x40: //F7 - Not mapped to an MZ-80K key
+                 mznexttheme(PALDISPLAY); // Next MZ-80K display colours
+                 break;
+      case 0x41: //F8 - Not mapped to an MZ-80K key
+                 mznexttheme(PALSTATUS);  // Next status area colours
                  break;
 
       case 0x42: //F9 - no. times keymatrix scanned not used in std versions
                  break;
+      case 0x43: //F10 - Not mapped to an MZ-80K key
+                 mzrenderstats();         // Show scanline render statistics
+                 break;
 
       case 0x44: mzreaddump();            //F11 - read memory dump
                  break;
       case 0x45: mzsavedump();            //F12 - save memory dump
                  break;
+      case 0x46: mzscreenshot();          //Print Screen - save screenshot
+                 break;
+      case 0x47: mzrecord();              //Scroll Lock - start/stop recording
+                 break;
 
       case 0x49: processkey[8]=0x03^0xFF; //<INS>  (USB Insert)
                  break;
@@ -799,6 +881,66 @@ void mzhidmapkey(uint8_t usbk0, uint8_t modifier)
 
 #else
 
+/* Convert a (minicom) key press to a tape catalogue key while the */
+/* catalogue is shown                                              */
+static void mzcdccatkey(int32_t *usbc, int8_t ncodes)
+{
+  uint8_t key=0x00;
+  int16_t tftemp;                         // Temporary tape file variable
+
+  if (ncodes==1) {
+    switch (usbc[0]) {
+      case 0x0d: key=CATKEYENTER;         // Return - choose
+                 break;
+      case 0x08:                          // Backspace
+      case 0x7f: key=CATKEYDEL;
+                 break;
+      case 0x09:                          // Tab or Escape - close
+      case 0x1b: key=CATKEYEXIT;
+                 break;
+      default:   if ((usbc[0] >= 0x20) && (usbc[0] <= 0x7e)) {
+                   key=usbc[0];           // Lower case is found as
+                   if ((key >= 'a') && (key <= 'z')) key-=0x20; // capitals
+                 }
+                 break;
+    }
+  }
+
+  if ((ncodes==3)&&(usbc[0]==0x1b)&&(usbc[1]==0x5b)) {
+    switch (usbc[2]) {
+      case 0x41: key=CATKEYUP;            // Up arrow
+                 break;
+      case 0x42: key=CATKEYDOWN;          // Down arrow
+                 break;
+      case 0x43: key=CATKEYRIGHT;         // Right arrow
+                 break;
+      case 0x44: key=CATKEYLEFT;          // Left arrow
+                 break;
+      default:   break;
+    }
+  }
+
+  if ((ncodes==4)&&(usbc[0]==0x1b)&&(usbc[1]==0x5b)&&(usbc[3]==0x7e)) {
+    switch (usbc[2]) {
+      case 0x35: key=CATKEYPGUP;          // Page up
+                 break;
+      case 0x36: key=CATKEYPGDN;          // Page down
+                 break;
+      default:   break;
+    }
+  }
+
+  if (key == 0x00) return;                // Ignore other keys
+
+  // F1 carries on from a file or directory chosen
+  if ((tftemp=tapecatkey(key)) >= 0) {
+    tfno=tftemp;
+    tfwd=true;
+  }
+
+  return;
+}
+
 /* Only used by the diagnostic version - picomz-80k-diag.uf2         */
 /* Convert (minicom) key press to the MZ-80K keyboard map,           */
 /* then store in the processkey[] global (read on portB by the 8255) */
@@ -806,6 +948,12 @@ void mzcdcmapkey(int32_t *usbc, int8_t ncodes)
 {
   int16_t tftemp;                         // Temporary tape file variable
 
+  /* Keys go to the tape catalogue, not the MZ-80K, while it is shown */
+  if (tapecatactive()) {
+    mzcdccatkey(usbc,ncodes);
+    return;
+  }
+
   if (ncodes==1) {
     switch (usbc[0]) {
 
@@ -818,6 +966,8 @@ void mzcdcmapkey(int32_t *usbc, int8_t ncodes)
                  break;
       case 0x0d: processkey[8]=0x10^0xFF; //<CR>    (also ctrl M)
                  break;
+      case 0x09: tapecatopen();           //Tab - show the tape catalogue
+                 break;
       case 0x20: processkey[9]=0x02^0xFF; //<SPACE>
                  break;
       case 0x21: processkey[8]=0x01^0xFF; //!
@@ -1238,13 +1388,13 @@ void mzcdcmapkey(int32_t *usbc, int8_t ncodes)
                      tfwd=true;
                      tfno++;
                    }
-                   tftemp=tapeloader(tfno);      
+                   tftemp=tapeselect(tfno);      
                    if (tftemp >= 0) {       // If not at end of tape, increment
                      ++tfno;                // the tape file number
                    }
                    else {                   // Otherwise step back 1 file
                      --tfno;                // and preload it to memory again
-                     tftemp=tapeloader(tfno);
+                     tftemp=tapeselect(tfno);
                    }
                    break;
         case 0x51: //F2 - Not mapped to an MZ-80K key
@@ -1255,14 +1405,19 @@ void mzcdcmapkey(int32_t *usbc, int8_t ncodes)
                    if (tfno > 0) {          // Step back one file if not at
                      --tfno;                // first file on tape.
                    }
-                   tftemp=tapeloader(tfno); // Preload the file
+                   tftemp=tapeselect(tfno); // Preload the file
                    if (tfno < 0) {          // Oh - we're off the other end!!
                      tfno=0;                // Shouldn't happen ... but ...
-                     tfno=tapeloader(tfno);
+                     tfno=tapeselect(tfno);
                    }
                    break;
         case 0x52: //F3 - Not mapped to an MZ-80K key
-                   mzspinny(0);
+                   if (tapeopendir()) {     // Open the directory shown by
+                     tfno=0;                // F1/F2, starting at its first
+                     tfwd=true;             // file. If a file is shown,
+                   }                        // reset the tape counter.
+                   else
+                     mzspinny(0);
                    break;
         case 0x53: //F4 - Not mapped to an MZ-80K key
                    memset(mzemustatus,0x00,EMUSSIZE); // Clear status area
@@ -1298,10 +1453,16 @@ void mzcdcmapkey(int32_t *usbc, int8_t ncodes)
       (usbc[2]==0x31)&&(usbc[4]==0x7e)) {
     switch (usbc[3]) {
       case 0x36: //F5 - Not mapped to an MZ-80K key
-                 uint16_t temp;
-                 temp=whitepix;            //Reverse video
-                 whitepix=blackpix;
-                 blackpix=temp;
+                 mzreversevideo();         //Reverse video
+                 break;
+      case 0x37: //F6 - Not mapped to an MZ-80K key
+                 vgalatch=!vgalatch;       //Frame consistent VRAM on/off
+                 break;
+      case 0x38: //F7 - Not mapped to an MZ-80K key
+                 mznexttheme(PALDISPLAY);  //Next MZ-80K display colours
+                 break;
+      case 0x39: //F8 - Not mapped to an MZ-80K key
+                 mznexttheme(PALSTATUS);   //Next status area colours
                  break;
 
       default:   break;                    //Ignore unmapped keys
@@ -1317,10 +1478,14 @@ void mzcdcmapkey(int32_t *usbc, int8_t ncodes)
                    scantimes=1;            //     per keypress. Default=1
                  mzemustatus[EMULINE4-1]=0x20+scantimes;
                  break;
+      case 0x31: mzrenderstats();          //F10 - show render statistics
+                 break;
       case 0x33: mzreaddump();             //F11 - read memory dump
                  break;
       case 0x34: mzsavedump();             //F12 - save memory dump
                  break;
+      case 0x35: mzscreenshot();           //F13 - save screenshot, as
+                 break;                    //terminals send no Print Screen
       default:   break;                    //Ignore unmapped keys
     }
   }
@@ -284,3 +284,21 @@ uint8_t mzascii2mzdisplay(uint8_t ascii)
 
   return(displaychar);
 }
+
+/* Convert an unsigned number to MZ display digits (no leading zeros). */
+/* Returns the number of digits written to converted.                  */
+uint8_t mznum2mzdisplay(uint32_t num, uint8_t* converted)
+{
+  uint8_t digits[10];                    // 2^32 has 10 decimal digits
+  uint8_t ndigits=0;
+
+  do {
+    digits[ndigits++]=0x20+(num%10);     // MZ display code for 0 is 0x20
+    num/=10;
+  } while (num > 0);
+
+  for (uint8_t i=0; i<ndigits; i++)
+    converted[i]=digits[ndigits-1-i];
+
+  return(ndigits);
+}
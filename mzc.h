@@ -0,0 +1,112 @@
+/* Sharp MZ-80K emulator - compressed tape file format             */
+/* Shared by the tape player (cassette.c) and the host packer      */
+/* (tools/mzpack.c), so must not depend on the Pico SDK.           */
+/*                                                                 */
+/* A compressed tape file (.mzc) is an 8 byte header - "MZC1" and  */
+/* the size of the .mzf file image (32 bit, little endian) - then  */
+/* the 128 byte tape header, uncompressed, then the tape body      */
+/* compressed with LZSS using a 4 Kbyte window.                    */
+/*                                                                 */
+/* The LZSS stream is a flag byte, then the eight items it         */
+/* describes, lsb first, then the next flag byte and so on. A 1    */
+/* flag is a literal byte. A 0 flag is a two byte reference to an  */
+/* earlier part of the body: the low 8 bits of distance-1, then    */
+/* the high 4 bits of distance-1 in the top nibble and length-3 in */
+/* the bottom nibble - so a reference copies 3 to 18 bytes from 1  */
+/* to 4096 bytes back.                                             */
+/*                                                                 */
+/* mzc_decode() works through the stream a piece at a time, so a   */
+/* body can be decompressed as it is read, in constant memory.     */
+
+#ifndef MZC_H
+#define MZC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "mzf.h"
+
+#define MZCMAGIC      "MZC1"  // File header magic
+#define MZCHDRSIZE    8       // File header size
+#define MZCWINDOW     4096    // Window size - power of 2
+#define MZCMINMATCH   3       // Shortest reference
+#define MZCMAXMATCH   (MZCMINMATCH+15) // Longest reference
+
+/* Check that the image size in a file header agrees with the body */
+/* length in the tape header that follows it                       */
+static inline bool mzc_sizeok(const uint8_t *mzchdr, const uint8_t *tapehdr)
+{
+  uint32_t imagelen=mzchdr[4]|(mzchdr[5]<<8)|((uint32_t) mzchdr[6]<<16)|
+                    ((uint32_t) mzchdr[7]<<24);
+
+  return(imagelen == MZFHDRSIZE+
+                     (uint32_t) (tapehdr[MZFLENGTH]|(tapehdr[MZFLENGTH+1]<<8)));
+}
+
+/* Decoder state - keeps the last MZCWINDOW bytes decoded */
+typedef struct mzcstate {
+  uint8_t  hist[MZCWINDOW];   // Window of bytes decoded
+  uint16_t histpos;           // Next position in hist
+  uint16_t flags;             // Flag bits left, above a marker bit
+  uint16_t copydist;          // Reference being copied
+  uint8_t  copylen;
+  uint8_t  ref0;              // First byte of a reference, once read
+  uint8_t  refpart;           // 1 if ref0 has been read
+} mzcstate;
+
+static inline void mzc_init(mzcstate *s)
+{
+  memset(s,0,sizeof(mzcstate));
+  return;
+}
+
+/* Decode up to outlen bytes from inlen bytes of the stream. Returns */
+/* the number of input bytes used - *made is set to the number of    */
+/* bytes decoded. Stops early when the input runs out, so it can be  */
+/* called again with more.                                           */
+static inline uint32_t mzc_decode(mzcstate *s, const uint8_t *in,
+                                  uint32_t inlen, uint8_t *out,
+                                  uint32_t outlen, uint32_t *made)
+{
+  uint32_t used=0, n=0;
+  uint8_t byte, ref1;
+
+  while (n < outlen) {
+    if (s->copylen > 0) {              // Copy from the window
+      byte=s->hist[(s->histpos-s->copydist)&(MZCWINDOW-1)];
+      --s->copylen;
+    }
+    else {
+      if (used >= inlen) break;        // Needs more input
+      if (s->flags <= 1) {             // Next flag byte
+        s->flags=in[used++]|0x100;
+        continue;
+      }
+      if (s->flags & 1) {              // Literal
+        byte=in[used++];
+        s->flags>>=1;
+      }
+      else if (s->refpart == 0) {      // First byte of a reference
+        s->ref0=in[used++];
+        s->refpart=1;
+        continue;
+      }
+      else {                           // Second byte - start copying
+        ref1=in[used++];
+        s->refpart=0;
+        s->flags>>=1;
+        s->copydist=(s->ref0|((ref1>>4)<<8))+1;
+        s->copylen=(ref1&0x0F)+MZCMINMATCH;
+        continue;
+      }
+    }
+    s->hist[s->histpos]=byte;
+    s->histpos=(s->histpos+1)&(MZCWINDOW-1);
+    out[n++]=byte;
+  }
+
+  *made=n;
+  return(used);
+}
+
+#endif
@@ -0,0 +1,109 @@
+/* Sharp MZ-80K emulator - tape header parser                      */
+/* Shared by the tape player (cassette.c) and the host tools       */
+/* (tools/mzt.c, tools/mzpack.c), so must not depend on the Pico   */
+/* SDK.                                                            */
+/*                                                                 */
+/* Every tape header is checked by mzf_parse() before it is used,  */
+/* so a damaged or hostile file is turned away when it is indexed  */
+/* or preloaded rather than part way through a LOAD. The checks    */
+/* are cheap - only the 128 byte header and the size of the file   */
+/* are looked at:                                                  */
+/*                                                                 */
+/*   - the body must be no longer than the file holds              */
+/*   - the body must fit in user RAM                               */
+/*   - machine code must load into RAM (user RAM or video RAM)     */
+/*     and start in the monitor ROM or user RAM                    */
+/*                                                                 */
+/* Pico MZ-80K memory dumps (type 0x20) are never loaded by the    */
+/* monitor, so only the first check applies to them.               */
+
+#ifndef MZF_H
+#define MZF_H
+
+#include <stdint.h>
+
+#define MZFHDRSIZE    128     // Tape header size
+#define MZFTYPE       0       // Header - file type
+#define MZFNAME       1       //        - file name (17 bytes)
+#define MZFLENGTH     18      //        - body length
+#define MZFLOAD       20      //        - load address
+#define MZFEXEC       22      //        - execution address
+
+#define MZFMACHINE    0x01    // Machine code file type
+#define MZFDUMP       0x20    // Pico MZ-80K memory dump file type
+
+#define MZFRAMSTART   0x1000  // Start of user RAM
+#define MZFVRAMSTART  0xD000  // Start of video RAM
+#define MZFVRAMEND    0xD400  // End of video RAM
+#define MZFBODYMAX    48640   // Longest body - 0x1200 to 0xCFFF
+
+#define MZFANYSIZE    0xFFFFFFFF // Body bytes in the file not known -
+                                 // a compressed file
+
+/* mzf_parse() results */
+#define MZFOK         0       // Good header
+#define MZFSHORT      1       // File shorter than the body length
+#define MZFBADLENGTH  2       // Body too long for user RAM
+#define MZFBADLOAD    3       // Machine code loads outside RAM
+#define MZFBADEXEC    4       // Machine code starts outside ROM or RAM
+
+/* What a tape header says about its file */
+typedef struct mzfinfo {
+  uint8_t  type;              // File type
+  uint16_t bodylen;           // Body length in bytes
+  uint16_t loadaddr;          // Load address
+  uint16_t execaddr;          // Execution address
+  uint16_t hchk;              // Header checksum
+} mzfinfo;
+
+/* MZ-80K checksums are the number of 1 bits, modulo 2^16 */
+static inline uint16_t mzf_checksum(const uint8_t *bytes, uint32_t len)
+{
+  uint16_t sum=0;
+
+  for (uint32_t i=0;i<len;i++)
+    sum+=__builtin_popcount(bytes[i]);
+
+  return(sum);
+}
+
+/* Check a tape header, with avail bytes of the file after it (or  */
+/* MZFANYSIZE), and fill in info. Returns MZFOK or the first check */
+/* that failed.                                                    */
+static inline uint8_t mzf_parse(const uint8_t *hdr, uint32_t avail,
+                                mzfinfo *info)
+{
+  info->type=hdr[MZFTYPE];
+  info->bodylen=hdr[MZFLENGTH]|(hdr[MZFLENGTH+1]<<8);
+  info->loadaddr=hdr[MZFLOAD]|(hdr[MZFLOAD+1]<<8);
+  info->execaddr=hdr[MZFEXEC]|(hdr[MZFEXEC+1]<<8);
+  info->hchk=mzf_checksum(hdr,MZFHDRSIZE);
+
+  if ((avail != MZFANYSIZE) && (avail < info->bodylen)) return(MZFSHORT);
+  if (info->type == MZFDUMP) return(MZFOK);
+  if (info->bodylen > MZFBODYMAX) return(MZFBADLENGTH);
+
+  if (info->type == MZFMACHINE) {
+    if ((info->loadaddr < MZFRAMSTART) ||
+        ((uint32_t) info->loadaddr+info->bodylen > MZFVRAMEND))
+      return(MZFBADLOAD);
+    if (info->execaddr >= MZFVRAMSTART) return(MZFBADEXEC);
+  }
+
+  return(MZFOK);
+}
+
+/* Describe an mzf_parse() result */
+static inline const char *mzf_error(uint8_t result)
+{
+  switch (result) {
+    case MZFOK:        return("good header");
+    case MZFSHORT:     return("file shorter than its body length");
+    case MZFBADLENGTH: return("body too long for user RAM");
+    case MZFBADLOAD:   return("machine code loads outside RAM");
+    case MZFBADEXEC:   return("machine code starts outside ROM or RAM");
+    default:           return("unknown error");
+  }
+}
+
+#endif
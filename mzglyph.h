@@ -0,0 +1,106 @@
+/* Sharp MZ-80K emulator - character glyph expansion            */
+/* Shared by the VGA output (vgadisplay.c) and the host tools,  */
+/* so must not depend on the Pico SDK beyond pico.h, which is   */
+/* left out of the host build (MZHOST).                         */
+
+#ifndef MZGLYPH_H
+#define MZGLYPH_H
+
+#include <stdint.h>
+
+// On the Pico the helpers below are called from core 1's line renderers,
+// which run from RAM - an outlined copy would run from flash and stall
+// the scanline on a cache miss, so they are always inlined there
+#ifdef MZHOST
+  #define MZGINLINE static inline
+#else
+  #include "pico.h"
+  #define MZGINLINE static __force_inline
+#endif
+
+#define MZGCOLS         40     // Characters in one MZ-80K display row
+#define MZGWIDTH        8      // Pixels in one character row
+#define MZGHEIGHT       8      // Pixel rows in one character
+#define MZGTHEMES       3      // Number of colour themes
+
+// Colour themes as RGB8 foreground (lit) and background pixels.
+// On the MZ-80K, pixels are either white or black. Green and amber
+// phosphor themes are also available.
+static const uint8_t mzgthemes[MZGTHEMES][2][3] = {
+  { {255,255,255}, {0,0,0}   },   // White
+  { {51,255,102},  {0,24,0}  },   // Green phosphor
+  { {255,176,0},   {24,12,0} }    // Amber phosphor
+};
+
+/* Build the lookup table that expands a nibble of a character ROM row */
+/* to 4 pixels - two 16 bit pixels per 32 bit word, leftmost pixel in   */
+/* the low half of the first word.                                      */
+MZGINLINE void mzglyph_lut(uint32_t lut[16][2], uint16_t fg, uint16_t bg)
+{
+  uint32_t pix[4];
+
+  for (uint8_t nibble=0;nibble<16;nibble++) {
+    for (uint8_t bit=0;bit<4;bit++)    // Bit 3 is the leftmost pixel
+      pix[bit]=((nibble<<bit)&0x08) ? fg : bg;
+    lut[nibble][0]=pix[0]|(pix[1]<<16);
+    lut[nibble][1]=pix[2]|(pix[3]<<16);
+  }
+  return;
+}
+
+/* As mzglyph_lut(), but every pixel is doubled - 8 pixels per nibble */
+MZGINLINE void mzglyph_lut2x(uint32_t lut[16][4], uint16_t fg, uint16_t bg)
+{
+  uint32_t pix;
+
+  for (uint8_t nibble=0;nibble<16;nibble++) {
+    for (uint8_t bit=0;bit<4;bit++) {
+      pix=((nibble<<bit)&0x08) ? fg : bg;
+      lut[nibble][bit]=pix|(pix<<16);
+    }
+  }
+  return;
+}
+
+/* Expand one pixel row of 40 characters into 160 pixel words (320    */
+/* pixels). cgrow points at the wanted pixel row of character 0 in    */
+/* the character ROM. No branches, so compilers can vectorise it.     */
+MZGINLINE void mzglyph_row(uint32_t *words, const uint8_t *chars,
+                           const uint8_t *cgrow,
+                           const uint32_t lut[16][2])
+{
+  for (uint8_t colidx=0;colidx<MZGCOLS;colidx++) {
+    uint8_t charbits = cgrow[chars[colidx]*MZGWIDTH];
+    const uint32_t *hi = lut[charbits>>4];
+    const uint32_t *lo = lut[charbits&0x0F];
+    *words++ = hi[0];
+    *words++ = hi[1];
+    *words++ = lo[0];
+    *words++ = lo[1];
+  }
+  return;
+}
+
+/* Expand one pixel row of 40 characters into 320 pixel words (640    */
+/* pixels), using a table built by mzglyph_lut2x()                    */
+MZGINLINE void mzglyph_row2x(uint32_t *words, const uint8_t *chars,
+                             const uint8_t *cgrow,
+                             const uint32_t lut[16][4])
+{
+  for (uint8_t colidx=0;colidx<MZGCOLS;colidx++) {
+    uint8_t charbits = cgrow[chars[colidx]*MZGWIDTH];
+    const uint32_t *hi = lut[charbits>>4];
+    const uint32_t *lo = lut[charbits&0x0F];
+    *words++ = hi[0];
+    *words++ = hi[1];
+    *words++ = hi[2];
+    *words++ = hi[3];
+    *words++ = lo[0];
+    *words++ = lo[1];
+    *words++ = lo[2];
+    *words++ = lo[3];
+  }
+  return;
+}
+
+#endif
@@ -0,0 +1,74 @@
+/* Sharp MZ-80K emulator - screen recording format                 */
+/* Shared by the recorder (recording.c) and the host player, so    */
+/* must not depend on the Pico SDK.                                */
+/*                                                                 */
+/* A recording is an 8 byte header followed by frame records. The  */
+/* header is "MZV1", the frame rate (vertical blanks per second),  */
+/* the display width and height in characters and a spare byte.    */
+/*                                                                 */
+/* Each frame record is a tag byte (MZRKEY or MZRDELTA), the       */
+/* number of vertical blanks since the previous record and a list  */
+/* of run length coded operations ending with MZREND. Operations   */
+/* work along the 1000 byte screen from position 0:                */
+/*                                                                 */
+/*   0x01-0x7F  n literal display codes follow                     */
+/*   0x80-0xBF  the next display code is repeated (op-0x80)+3 times*/
+/*   0xC0-0xFF  (op-0xC0)+1 display codes are unchanged            */
+/*                                                                 */
+/* A key frame clears the screen (to display code 0x00) before its */
+/* operations are applied, so playback can start at any key frame. */
+
+#ifndef MZREC_H
+#define MZREC_H
+
+#include <stdint.h>
+
+#define MZRMAGIC      "MZV1"  // File header magic
+#define MZRHDRSIZE    8       // File header size
+#define MZRCOLS       40      // Display width in characters
+#define MZRROWS       25      // Display height in characters
+#define MZRCHARS      (MZRCOLS*MZRROWS) // Visible MZ-80K display codes
+#define MZRKEY        'K'     // Key frame
+#define MZRDELTA      'D'     // Changes since the previous frame
+#define MZRMAXTICKS   255     // Largest vertical blank count in a record
+
+#define MZREND        0x00    // End of frame
+#define MZRLIT        0x00    // Literal run - op is the length
+#define MZRMAXLIT     127
+#define MZRREP        0x80    // Repeated display code
+#define MZRMINREP     3
+#define MZRMAXREP     (MZRMINREP+63)
+#define MZRSKIP       0xC0    // Unchanged display codes
+#define MZRMAXSKIP    64
+
+/* Apply the operations of one frame record to a 1000 byte screen.  */
+/* Returns the number of bytes used, or -1 if the record is corrupt. */
+static inline int mzrec_apply(uint8_t *screen, const uint8_t *ops, int len)
+{
+  int used=0, pos=0, n;
+  uint8_t op;
+
+  while (used < len) {
+    op=ops[used++];
+    if (op == MZREND)
+      return(used);
+    if (op < MZRREP) {                 // Literal run
+      n=op;
+      if ((pos+n > MZRCHARS) || (used+n > len)) return(-1);
+      for (int i=0;i<n;i++) screen[pos++]=ops[used++];
+    }
+    else if (op < MZRSKIP) {           // Repeated display code
+      n=(op-MZRREP)+MZRMINREP;
+      if ((pos+n > MZRCHARS) || (used >= len)) return(-1);
+      for (int i=0;i<n;i++) screen[pos++]=ops[used];
+      ++used;
+    }
+    else {                             // Unchanged
+      pos+=(op-MZRSKIP)+1;
+      if (pos > MZRCHARS) return(-1);
+    }
+  }
+  return(-1);                          // No MZREND
+}
+
+#endif
@@ -0,0 +1,82 @@
+/* Sharp MZ-80K emulator - multi-program tape container format    */
+/* Shared by the tape player (cassette.c) and the host tool        */
+/* (tools/mzt.c), so must not depend on the Pico SDK.              */
+/*                                                                 */
+/* A container (.mzt) holds several MZ-80K programs, as a real     */
+/* tape does. It starts with a 16 byte header - "MZT1", the number */
+/* of programs (16 bit, little endian) and 10 spare bytes - then   */
+/* an index with a 24 byte entry for each program:                 */
+/*                                                                 */
+/*   0-3   file offset of the program's 128 byte tape header       */
+/*   4-5   body length in bytes                                    */
+/*   6     file type, from the tape header                         */
+/*   7-23  file name, from the tape header                         */
+/*                                                                 */
+/* All values are little endian. Each program is stored as its     */
+/* .mzf file image - tape header, then body - starting on a 512    */
+/* byte boundary, so its sectors line up with sd card sectors just */
+/* as a .mzf file's do. Gaps are filled with zeros.                */
+
+#ifndef MZT_H
+#define MZT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "mzf.h"
+
+#define MZTMAGIC      "MZT1"  // File header magic
+#define MZTHDRSIZE    16      // File header size
+#define MZTENTRYSIZE  24      // Index entry size
+#define MZTALIGN      512     // Programs start on a multiple of this
+#define MZTMAXPROGS   512     // Most programs in one container
+
+#define MZTOFFSET     0       // Index entry - offset of the tape header
+#define MZTLENGTH     4       //             - body length
+#define MZTTYPE       6       //             - file type
+#define MZTNAME       7       //             - file name (17 bytes)
+
+static inline uint16_t mzt_get16(const uint8_t *p)
+{
+  return(p[0]|(p[1]<<8));
+}
+
+static inline uint32_t mzt_get32(const uint8_t *p)
+{
+  return(p[0]|(p[1]<<8)|((uint32_t) p[2]<<16)|((uint32_t) p[3]<<24));
+}
+
+static inline void mzt_put16(uint8_t *p, uint16_t value)
+{
+  p[0]=value&0xFF;
+  p[1]=(value>>8)&0xFF;
+  return;
+}
+
+static inline void mzt_put32(uint8_t *p, uint32_t value)
+{
+  mzt_put16(p,value&0xFFFF);
+  mzt_put16(p+2,(value>>16)&0xFFFF);
+  return;
+}
+
+/* Check that the index of nprogs entries fits in a container of */
+/* size bytes                                                    */
+static inline bool mzt_indexok(uint16_t nprogs, uint32_t size)
+{
+  return((size >= MZTHDRSIZE) &&
+         ((size-MZTHDRSIZE)/MZTENTRYSIZE >= nprogs));
+}
+
+/* Check that the program an index entry describes - tape header */
+/* and body - is wholly inside a container of size bytes with an */
+/* index of nprogs entries, and after that index. No sum can     */
+/* wrap, whatever the entry holds.                               */
+static inline bool mzt_entryok(uint32_t offset, uint16_t bodylen,
+                               uint16_t nprogs, uint32_t size)
+{
+  if (offset < MZTHDRSIZE+(uint32_t) nprogs*MZTENTRYSIZE) return(false);
+  if (size < MZFHDRSIZE+(uint32_t) bodylen) return(false);
+  return(offset <= size-MZFHDRSIZE-bodylen);
+}
+
+#endif
@@ -204,14 +204,18 @@ int main(void)
   SHOW("USB keyboard connected\n");
   mzpicoled(0);
 
-  // Mount the sd card to act as a tape source
+  // Mount the sd card to act as a tape source. Without one, the
+  // tape library in flash is used instead, if there is one.
   FRESULT tapestatus;
   tapestatus=tapeinit(); 
-  if (tapestatus != FR_OK) {
+  if ((tapestatus != FR_OK) && (tapeflashinit() > 0)) {
+    SHOW("Error: sd card failed to initialise - using flash library\n");
+  }
+  else if (tapestatus != FR_OK) {
     SHOW("Error: sd card failed to initialise\n");
     // We've been unable to mount the sd card, so signal this with
     // 1s long pulses on the pico led. Emulator will need restarting
-    // as without the sd card it's not much use!
+    // as without the sd card (or a flash library) it's not much use!
     toggle=1;
     mzpicoled(toggle);
     while (true) {
@@ -220,7 +224,13 @@ int main(void)
       mzpicoled(toggle);
     }
   }
-  SHOW("microSD card mounted ok\n");
+  else
+    SHOW("microSD card mounted ok\n");
+
+  // VGA640.CFG in the root of the sd card selects the pixel doubled
+  // 640x480 output mode at boot time
+  if (f_stat("VGA640.CFG",NULL) == FR_OK) vgahires=true;
+  SHOW("VGA output mode is %s\n",vgahires?"640x480":"320x240");
 
   // Start VGA output on the second core
   multicore_launch_core1(vga_main);
@@ -230,6 +240,8 @@ int main(void)
   for(;;) {
 
     z80_step(&mzcpu);		  // Execute next z80 opcode
+    mzrecordtask();               // Record the screen if recording
+    mzsdiotask();                 // Queued sd card work
   #if ! defined (USBDIAGOUTPUT) && defined (PICO2)
     busy_wait_us(1);              // Need to slow down a Pico 2 a little more
   #endif
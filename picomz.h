@@ -40,29 +40,35 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
-#ifndef USBDIAGOUTPUT
-  #include "tusb_config.h" // Needs to come before tusb.h as it
-#endif                     // overrides settings in tusb_options.h
-#include <tusb.h>        
-#include "pico.h"
-#include "pico/stdlib.h"
-#include "pico/multicore.h"
-#include "pico/binary_info.h"
-#include "pico/util/datetime.h"
-#include "pico/scanvideo.h"
-#include "pico/sync.h"
-#include "pico/scanvideo/composable_scanline.h"
-#include "pico/time.h"
-#include "hardware/gpio.h"
-#include "hardware/pwm.h"
-#include "hardware/clocks.h"
-#ifdef RC2014RP2040VGA
-  #include "hardware/i2c.h"  // Required for RC2014 RP2040 VGA card
+#ifndef MZHOST             // MZHOST is defined by the host tools build,
+                           // which has no Pico SDK (see tools/)
+  #ifndef USBDIAGOUTPUT
+    #include "tusb_config.h" // Needs to come before tusb.h as it
+  #endif                     // overrides settings in tusb_options.h
+  #include <tusb.h>        
+  #include "pico.h"
+  #include "pico/stdlib.h"
+  #include "pico/multicore.h"
+  #include "pico/binary_info.h"
+  #include "pico/util/datetime.h"
+  #include "pico/scanvideo.h"
+  #include "pico/sync.h"
+  #include "pico/scanvideo/composable_scanline.h"
+  #include "pico/time.h"
+  #include "hardware/gpio.h"
+  #include "hardware/pwm.h"
+  #include "hardware/clocks.h"
+  #include "hardware/structs/systick.h"
+  #ifdef RC2014RP2040VGA
+    #include "hardware/i2c.h"  // Required for RC2014 RP2040 VGA card
+  #endif
 #endif
 #include "fatfs/ffconf.h"
 #include "fatfs/ff.h"
-#include "sdcard/sdcard.h"
-#include "sdcard/pio_spi.h"
+#ifndef MZHOST
+  #include "sdcard/sdcard.h"
+  #include "sdcard/pio_spi.h"
+#endif
 #include "zazu80/z80.h"
 
 /* Low-level debugging code macro for printf() */
@@ -133,6 +139,10 @@
 #define EMULINE3    120
 #define EMULINE4    160
 
+/* Palettes used by the MZ-80K display and the emulator status area */
+#define PALDISPLAY    0
+#define PALSTATUS     1
+
 /* Tape header and maximum body sizes in bytes */
 #define TAPEHEADERSIZE    128 // 128 bytes
 #define TAPEBODYMAXSIZE 48640 // 47.5Kbytes
@@ -153,6 +163,34 @@ typedef struct pit8253 {
 
 } pit8253;
 
+/* Keys for the tape catalogue (cassette.c) - printable characters */
+/* are passed as ASCII                                             */
+#define CATKEYUP      0x01
+#define CATKEYDOWN    0x02
+#define CATKEYLEFT    0x03
+#define CATKEYRIGHT   0x04
+#define CATKEYPGUP    0x05
+#define CATKEYPGDN    0x06
+#define CATKEYDEL     0x08
+#define CATKEYENTER   0x0D
+#define CATKEYEXIT    0x1B
+
+/* sd card worker job (sdio.c) - called by mzsdiotask() with first true */
+/* on the first call for a request, until it stops returning SDIOMORE   */
+#define SDIOMORE      0    // Job has more to do
+#define SDIODONE      1    // Job finished
+#define SDIOFAILED    2    // Job failed
+typedef uint8_t (*sdiojob)(int16_t arg, bool first);
+
+/* Display frame timing - written by core 1 (vgadisplay.c), read by core 0 */
+/* seq is incremented before and after each update, so a reader that sees */
+/* an odd value, or a value that changes during its read, must try again  */
+typedef struct vgaframe {
+  volatile uint32_t seq;     /* Sequence counter - odd during an update */
+  volatile uint32_t count;   /* Frames started since VGA output began */
+  volatile uint8_t vblank;   /* 1 outside the 200 line MZ-80K display */
+} vgaframe;
+
 /* picomz.c */
 extern z80 mzcpu;
 extern uint8_t mzuserram[URAMSIZE];
@@ -176,27 +214,52 @@ extern uint8_t processkey[KBDROWS];
 extern uint8_t crstate;
 extern uint8_t cwstate; 
 extern uint8_t header[TAPEHEADERSIZE];
-extern uint8_t body[TAPEBODYMAXSIZE];
 extern void reset_tape(void);
 extern uint8_t cread(void);
 extern void cwrite(uint8_t);
 extern uint8_t tapeinit(void);
+extern uint16_t tapeflashinit(void);
 extern int16_t tapeloader(int16_t);
+extern int16_t tapeselect(int16_t);
+extern bool tapeopendir(void);
+extern void tapecatopen(void);
+extern bool tapecatactive(void);
+extern int16_t tapecatkey(uint8_t);
+extern uint8_t *tapestatusarea(void);
 extern FRESULT mzsavedump(void);
 extern FRESULT mzreaddump(void);
 extern void mzspinny(uint8_t);
 
 /* vgadisplay.c */
-extern uint16_t whitepix;
-extern uint16_t blackpix;
+extern bool vgahires;
+extern vgaframe mzframe;
+extern volatile bool vgalatch;
+extern volatile uint8_t cblinklatch;
+extern uint8_t mzvblank(uint32_t*);
+extern void mzreversevideo(void);
+extern void mznexttheme(uint8_t);
+extern void mzpalettergb(uint8_t, const uint8_t**, const uint8_t**);
+extern void mzrenderstats(void);
 extern void vga_main(void);
 
+/* screenshot.c */
+extern void mzscreenshot(void);
+
+/* recording.c */
+extern void mzrecord(void);
+extern void mzrecordtask(void);
+
+/* sdio.c */
+extern void mzsdiostatus(uint8_t*);
+extern bool mzsdiorequest(sdiojob, int16_t);
+extern void mzsdiotask(void);
+
 /* 8255.c */
 extern uint8_t portC;
 extern uint8_t cmotor;
 extern uint8_t csense;
-extern uint8_t vgate;
-extern uint8_t vblank;
+extern volatile uint8_t vgate;
+extern volatile uint8_t cblink;
 #ifdef USBDIAGOUTPUT
   extern uint8_t scantimes;
 #endif
@@ -216,6 +279,7 @@ extern void mzpicoled(uint8_t);
 extern void ascii2mzdisplay(uint8_t*, uint8_t*);
 extern uint8_t mzsafefilechar(uint8_t);
 extern uint8_t mzascii2mzdisplay(uint8_t);
+extern uint8_t mznum2mzdisplay(uint32_t, uint8_t*);
 
 /* pca9536.c - used by RC2014 RP2040 VGA card */
 #ifdef RC2014RP2040VGA
@@ -0,0 +1,268 @@
+/* Sharp MZ-80K emulator - screen recording to sd card */
+/* Tim Holyoake, 2025                                  */
+
+#include "picomz.h"
+#include "mzrec.h"
+
+// Recordings hold the changes to the MZ-80K display every other frame,
+// run length coded as described in mzrec.h, with a key frame every
+// 30 seconds. Scroll Lock starts and stops recording to RECnnnn.MZV.
+//
+// All the work is done by mzrecordtask(), called from the main emulator
+// loop. Each call does at most one small piece of work - takes a copy of
+// the video RAM, codes one row's worth of changes, or writes one sector
+// of the output buffer to the sd card - so the Z80 is never held up.
+// Frames that arrive while the output buffer is too full are skipped;
+// their changes are picked up by the next frame that is recorded.
+
+#define RECFRAMES      2             // Vertical blanks between frames
+#define RECKEYFRAMES   1800          // Vertical blanks between key frames
+#define RECRATE        60            // Vertical blanks per second
+#define RECSLICE       100           // Calls to mzrecordtask() between
+                                     // each piece of work
+#define RECROW         40            // Display codes coded per piece
+#define RECSECTOR      512           // Bytes written to sd card at once
+#define RECBUFSIZE     2048          // Output buffer - power of 2
+
+// Worst case frame record. Codes that change and don't change in turn
+// are each a one code literal run (2 bytes) then a one code skip
+// (1 byte) - 3 bytes for every 2 display codes. No other mix of runs
+// costs more. Add the tag, the vertical blank count and MZREND.
+#define RECMAXFRAME    (2+(3*MZRCHARS+1)/2+1)
+
+#define RECIDLE        0             // Not recording
+#define RECOPEN        1             // Find an unused file name and open it
+#define RECRUN         2             // Recording
+#define RECFLUSH       3             // Write the rest of the buffer and close
+
+static uint8_t recstate=RECIDLE;     // Recording state
+static bool recstop;                 // Stop once the current frame is coded
+static uint8_t reccur[MZRCHARS];     // Copy of VRAM being coded
+static uint8_t recprev[MZRCHARS];    // VRAM as at the last frame recorded
+static uint16_t recpos;              // Next display code to code
+static uint32_t recframe;            // Frame count when last checked
+static uint32_t recticks;            // Vertical blanks since last record
+static uint32_t reckeyticks;         // Vertical blanks since last key frame
+static uint32_t recdropped;          // Frames skipped - buffer full
+static uint8_t recbuf[RECBUFSIZE];   // Output buffer
+static uint32_t rechead,rectail;     // Output buffer in and out counts
+static uint16_t recno=0;             // Number in the recording file name
+static uint8_t recname[13];          // RECnnnn.MZV
+static FIL recfp;                    // Recording file
+
+/* Add a byte to the output buffer */
+static inline void recput(uint8_t byte)
+{
+  recbuf[(rechead++)&(RECBUFSIZE-1)]=byte;
+  return;
+}
+
+/* Code the next run of display codes in reccur against recprev */
+static void recencode(void)
+{
+  uint16_t pos=recpos;
+  uint16_t n,p;
+
+  if (reccur[pos] == recprev[pos]) {
+    // Unchanged display codes
+    for (n=1;(pos+n<MZRCHARS)&&(n<MZRMAXSKIP)&&
+             (reccur[pos+n]==recprev[pos+n]);n++);
+    recput(MZRSKIP+n-1);
+  }
+  else {
+    for (n=1;(pos+n<MZRCHARS)&&(n<MZRMAXREP)&&
+             (reccur[pos+n]==reccur[pos]);n++);
+    if (n >= MZRMINREP) {
+      // Repeated display code
+      recput(MZRREP+n-MZRMINREP);
+      recput(reccur[pos]);
+    }
+    else {
+      // Literal run - ends at an unchanged code or the start of a repeat
+      for (n=1;(pos+n<MZRCHARS)&&(n<MZRMAXLIT);n++) {
+        p=pos+n;
+        if (reccur[p] == recprev[p]) break;
+        if ((p+2 < MZRCHARS) && (reccur[p] == reccur[p+1]) &&
+            (reccur[p] == reccur[p+2])) break;
+      }
+      recput(MZRLIT+n);
+      for (p=pos;p<pos+n;p++) recput(reccur[p]);
+    }
+  }
+  recpos+=n;
+
+  return;
+}
+
+/* Write one full sector of the output buffer, or the remainder if */
+/* flushing. Returns false on a write error.                       */
+static bool recwrite(bool flush)
+{
+  uint32_t len=rechead-rectail;
+  uint bw;
+  FRESULT res;
+
+  if (len > RECSECTOR) len=RECSECTOR;
+  if ((len == 0) || ((len < RECSECTOR) && !flush)) return(true);
+
+  // rectail is always a multiple of RECSECTOR, so this never wraps
+  res=f_write(&recfp,&recbuf[rectail&(RECBUFSIZE-1)],len,&bw);
+  if ((res != FR_OK) || (bw != len)) {
+    SHOW("Error writing %s, status is %d\n",recname,res);
+    return(false);
+  }
+  rectail+=len;
+
+  return(true);
+}
+
+/* Start a frame record if the screen has changed or one is due */
+static void recnextframe(void)
+{
+  uint32_t frame,elapsed;
+  bool key;
+
+  mzvblank(&frame);
+  elapsed=frame-recframe;
+  if (elapsed < RECFRAMES) return;
+  recframe=frame;
+  recticks+=elapsed;
+  reckeyticks+=elapsed;
+
+  key=(reckeyticks >= RECKEYFRAMES);
+  memcpy(reccur,mzvram,MZRCHARS);
+  if ((!key) && (recticks < MZRMAXTICKS-RECFRAMES) &&
+      (memcmp(reccur,recprev,MZRCHARS) == 0)) return; // Nothing to record
+
+  if ((RECBUFSIZE-(rechead-rectail)) < RECMAXFRAME) {
+    ++recdropped;                      // No room - try again next frame
+    return;
+  }
+
+  if (key) {
+    memset(recprev,0x00,MZRCHARS);     // Key frames start from a clear screen
+    reckeyticks=0;
+  }
+  recput(key?MZRKEY:MZRDELTA);
+  recput((recticks>MZRMAXTICKS)?MZRMAXTICKS:recticks);
+  recticks=0;
+  recpos=0;
+
+  return;
+}
+
+/* Start or stop recording - called on core 0 when Scroll Lock is pressed */
+void mzrecord(void)
+{
+  if (recstate == RECIDLE) {
+    recstop=false;                     // A stop before the file is open
+    recstate=RECOPEN;                  // still takes effect
+    mzsdiostatus("Recording starting");
+  }
+  else
+    recstop=true;
+
+  return;
+}
+
+/* Do the next piece of recording work - called from the main loop */
+void mzrecordtask(void)
+{
+  static uint16_t slice=0;
+  uint16_t num;
+  uint16_t rowend;
+  uint8_t message[40];
+  FRESULT res;
+
+  if (recstate == RECIDLE) return;
+  if ((++slice) < RECSLICE) return;
+  slice=0;
+
+  switch (recstate) {
+
+    case RECOPEN:
+      // One f_stat() per call until an unused RECnnnn.MZV is found
+      num=recno;
+      memcpy(recname,"REC0000.MZV",12);
+      for (uint8_t i=6; i>=3; i--) {
+        recname[i]='0'+(num%10);
+        num/=10;
+      }
+      if (f_stat(recname,NULL) == FR_OK) {
+        recno=(recno+1)%10000;
+        break;
+      }
+
+      res=f_open(&recfp,recname,FA_CREATE_ALWAYS|FA_WRITE);
+      if (res) {
+        SHOW("Error on file open for %s, status is %d\n",recname,res);
+        mzsdiostatus("Recording failed");
+        recstate=RECIDLE;
+        break;
+      }
+
+      rechead=rectail=0;
+      for (uint8_t i=0; i<4; i++) recput(MZRMAGIC[i]);
+      recput(RECRATE);
+      recput(MZRCOLS);
+      recput(MZRROWS);
+      recput(0x00);
+
+      mzvblank(&recframe);
+      recframe-=RECFRAMES;             // First frame is recorded at once
+      recticks=0;
+      reckeyticks=RECKEYFRAMES;        // ... and is a key frame
+      recpos=MZRCHARS;
+      recdropped=0;
+      recstate=RECRUN;
+      SHOW("Recording to %s\n",recname);
+      snprintf(message,sizeof(message),"Recording to %s",recname);
+      mzsdiostatus(message);
+      break;
+
+    case RECRUN:
+      if (recpos < MZRCHARS) {
+        // Code the next row's worth of the current frame
+        rowend=recpos+RECROW;
+        while ((recpos < rowend) && (recpos < MZRCHARS))
+          recencode();
+        if (recpos >= MZRCHARS) {
+          recput(MZREND);
+          memcpy(recprev,reccur,MZRCHARS);
+        }
+      }
+      else if ((rechead-rectail) >= RECSECTOR) {
+        if (!recwrite(false)) {
+          f_close(&recfp);
+          mzsdiostatus("Recording failed");
+          recstate=RECIDLE;
+        }
+      }
+      else if (recstop)
+        recstate=RECFLUSH;
+      else
+        recnextframe();
+      break;
+
+    case RECFLUSH:
+      if (!recwrite(true)) {
+        f_close(&recfp);
+        mzsdiostatus("Recording failed");
+        recstate=RECIDLE;
+      }
+      else if (rechead == rectail) {
+        f_close(&recfp);
+        SHOW("Recording saved to %s, %d frames skipped\n",recname,recdropped);
+        snprintf(message,sizeof(message),"Recording saved: %s",recname);
+        mzsdiostatus(message);
+        recno=(recno+1)%10000;
+        recstate=RECIDLE;
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  return;
+}
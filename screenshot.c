@@ -0,0 +1,161 @@
+/* Sharp MZ-80K emulator - screenshots to sd card */
+/* Tim Holyoake, 2025                             */
+
+#include "picomz.h"
+#include "mzglyph.h"
+
+// Screenshots are 320x240 16 bit (X1R5G5B5) BMP files - the MZ-80K
+// display plus the emulator status area, in the current colours.
+// The Print Screen key takes a copy of the video RAM and status area
+// (a cheap memcpy). The BMP file is then written one scanline at a time
+// by shotjob(), queued for the sd card worker (sdio.c), so the Z80 is
+// never held up by more than a single short sd card write.
+
+#define SHOTWIDTH      320           // Pixels per scanline
+#define SHOTLINES      240           // Scanlines - 200 MZ-80K + 40 status
+#define SHOTDLINES     200           // Last scanline of the MZ-80K display
+#define SHOTCOLS       40            // Characters per line
+#define SHOTCHARS      1000          // Visible MZ-80K VRAM bytes
+#define SHOTROWBYTES   (SHOTWIDTH*2) // Bytes per BMP row
+#define SHOTHDRSIZE    54            // BMP file + info header size
+#define SHOTPACE       20            // Calls to shotjob() between each
+                                     // scanline written to sd card
+
+#define SHOTIDLE       0             // No screenshot in progress
+#define SHOTOPEN       1             // Find an unused file name and open it
+#define SHOTWRITE      2             // Write the next scanline
+
+static uint8_t shotstate=SHOTIDLE;   // Screenshot state
+static uint8_t shotchars[SHOTCHARS+EMUSSIZE]; // VRAM + status area copy
+static uint32_t shotlut[2][16][2];   // Display and status area lookups
+static uint32_t shotrow[SHOTROWBYTES/4];      // One BMP row
+static int16_t shotline;             // Next scanline to write (bottom up)
+static uint16_t shotno=0;            // Number in the screenshot file name
+static uint8_t shotname[13];         // SHOTnnnn.BMP
+static FIL shotfp;                   // Screenshot file
+
+/* Convert an RGB8 colour to a 16 bit BMP pixel */
+static uint16_t rgb2bmp(const uint8_t *rgb)
+{
+  return(((rgb[0]>>3)<<10)|((rgb[1]>>3)<<5)|(rgb[2]>>3));
+}
+
+/* Write a little endian 16 or 32 bit value into the BMP header */
+static void put16(uint8_t *dest, uint16_t value)
+{
+  dest[0]=value&0xFF;
+  dest[1]=(value>>8)&0xFF;
+  return;
+}
+
+static void put32(uint8_t *dest, uint32_t value)
+{
+  put16(dest,value&0xFFFF);
+  put16(dest+2,(value>>16)&0xFFFF);
+  return;
+}
+
+/* Write the next part of a screenshot - sd card worker job */
+static uint8_t shotjob(int16_t unused, bool first)
+{
+  static uint16_t pace=0;
+  uint8_t bmphdr[SHOTHDRSIZE];
+  uint8_t message[40];
+  uint16_t num;
+  uint bw;
+  FRESULT res;
+
+  // Keep the sd card writes spread out - a screenshot is never urgent
+  if (first) pace=0;
+  if ((++pace) < SHOTPACE) return(SDIOMORE);
+  pace=0;
+
+  if (shotstate == SHOTOPEN) {
+    // One f_stat() per call until an unused SHOTnnnn.BMP is found
+    num=shotno;
+    memcpy(shotname,"SHOT0000.BMP",13);
+    for (uint8_t i=7; i>=4; i--) {
+      shotname[i]='0'+(num%10);
+      num/=10;
+    }
+    if (f_stat(shotname,NULL) == FR_OK) {
+      shotno=(shotno+1)%10000;
+      return(SDIOMORE);
+    }
+
+    res=f_open(&shotfp,shotname,FA_CREATE_ALWAYS|FA_WRITE);
+    if (res) {
+      SHOW("Error on file open for %s, status is %d\n",shotname,res);
+      mzsdiostatus("Screenshot failed");
+      shotstate=SHOTIDLE;
+      return(SDIOFAILED);
+    }
+
+    memset(bmphdr,0,SHOTHDRSIZE);
+    bmphdr[0]='B';
+    bmphdr[1]='M';
+    put32(bmphdr+2,SHOTHDRSIZE+SHOTROWBYTES*SHOTLINES); // File size
+    put32(bmphdr+10,SHOTHDRSIZE);                      // Offset to pixels
+    put32(bmphdr+14,40);                               // Info header size
+    put32(bmphdr+18,SHOTWIDTH);
+    put32(bmphdr+22,SHOTLINES);                        // +ve = bottom up
+    put16(bmphdr+26,1);                                // Planes
+    put16(bmphdr+28,16);                               // Bits per pixel
+    put32(bmphdr+34,SHOTROWBYTES*SHOTLINES);           // Image size
+    put32(bmphdr+38,2835);                             // 72 dpi
+    put32(bmphdr+42,2835);
+    f_write(&shotfp,bmphdr,SHOTHDRSIZE,&bw);
+
+    shotline=SHOTLINES-1;
+    shotstate=SHOTWRITE;
+    return(SDIOMORE);
+  }
+
+  // BMP rows are stored bottom up
+  mzglyph_row(shotrow,&shotchars[(shotline/MZGHEIGHT)*SHOTCOLS],
+              cgrom+(shotline%MZGHEIGHT),
+              shotlut[(shotline>=SHOTDLINES)?PALSTATUS:PALDISPLAY]);
+  res=f_write(&shotfp,shotrow,SHOTROWBYTES,&bw);
+  if ((res != FR_OK) || (bw != SHOTROWBYTES)) {
+    SHOW("Error writing %s, status is %d\n",shotname,res);
+    f_close(&shotfp);
+    mzsdiostatus("Screenshot failed");
+    shotstate=SHOTIDLE;
+    return(SDIOFAILED);
+  }
+
+  if ((--shotline) < 0) {
+    f_close(&shotfp);
+    SHOW("Screenshot saved to %s\n",shotname);
+    snprintf(message,sizeof(message),"Screenshot saved: %s",shotname);
+    mzsdiostatus(message);
+    shotno=(shotno+1)%10000;
+    shotstate=SHOTIDLE;
+    return(SDIODONE);
+  }
+
+  return(SDIOMORE);
+}
+
+/* Capture the screen - called on core 0 when Print Screen is pressed */
+void mzscreenshot(void)
+{
+  const uint8_t *fg,*bg;
+
+  if (shotstate != SHOTIDLE) return;   // Previous screenshot still going
+
+  memcpy(shotchars,mzvram,SHOTCHARS);
+  memcpy(shotchars+SHOTCHARS,mzemustatus,EMUSSIZE);
+
+  // Same glyph expansion as the VGA output, in BMP pixels
+  mzpalettergb(PALDISPLAY,&fg,&bg);
+  mzglyph_lut(shotlut[PALDISPLAY],rgb2bmp(fg),rgb2bmp(bg));
+  mzpalettergb(PALSTATUS,&fg,&bg);
+  mzglyph_lut(shotlut[PALSTATUS],rgb2bmp(fg),rgb2bmp(bg));
+
+  if (!mzsdiorequest(shotjob,0)) return;
+  shotstate=SHOTOPEN;
+  mzsdiostatus("Screenshot in progress");
+
+  return;
+}
@@ -81,4 +81,57 @@ void __time_critical_func(pio_spi_repeat8_read8_blocking)(const pio_spi_inst_t *
             --rx_remain;
         }
     }
-}
\ No newline at end of file
+}
+
+// DMA transfers. The TX channel feeds the state machine and the RX channel
+// drains it, both paced by the PIO DREQs, so the CPU is free while a block
+// moves. Start a transfer, then poll pio_spi_dma_busy() until it is done.
+// The RX channel is started first and finishes last, as every byte clocked
+// out is also clocked in.
+
+static const uint8_t pio_spi_ones = 0xff;   // Clocked out on reads
+static uint8_t pio_spi_sink;                // Bytes clocked in on writes
+
+// The channels are fixed by the caller rather than claimed as unused, as
+// the sd card is set up before VGA output - which claims fixed channels of
+// its own - has started.
+void pio_spi_dma_init(pio_spi_inst_t *spi, uint tx_dma, uint rx_dma) {
+    if (spi->tx_dma < 0) {
+        dma_channel_claim(tx_dma);
+        spi->tx_dma = tx_dma;
+    }
+    if (spi->rx_dma < 0) {
+        dma_channel_claim(rx_dma);
+        spi->rx_dma = rx_dma;
+    }
+}
+
+static void pio_spi_dma_start(const pio_spi_inst_t *spi, const uint8_t *src, bool src_incr,
+                              uint8_t *dst, bool dst_incr, size_t len) {
+    dma_channel_config c = dma_channel_get_default_config(spi->rx_dma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, dst_incr);
+    channel_config_set_dreq(&c, pio_get_dreq(spi->pio, spi->sm, false));
+    dma_channel_configure(spi->rx_dma, &c, dst, (io_rw_8 *) &spi->pio->rxf[spi->sm], len, true);
+
+    // 8 bit writes are byte-replicated, as for the blocking functions
+    c = dma_channel_get_default_config(spi->tx_dma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, src_incr);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(spi->pio, spi->sm, true));
+    dma_channel_configure(spi->tx_dma, &c, (io_rw_8 *) &spi->pio->txf[spi->sm], src, len, true);
+}
+
+void pio_spi_write8_dma(const pio_spi_inst_t *spi, const uint8_t *src, size_t len) {
+    pio_spi_dma_start(spi, src, true, &pio_spi_sink, false, len);
+}
+
+void pio_spi_read8_dma(const pio_spi_inst_t *spi, uint8_t *dst, size_t len) {
+    pio_spi_dma_start(spi, &pio_spi_ones, false, dst, true, len);
+}
+
+bool pio_spi_dma_busy(const pio_spi_inst_t *spi) {
+    return dma_channel_is_busy(spi->rx_dma);
+}
@@ -7,12 +7,15 @@
 #define _PIO_SPI_H
 
 #include "hardware/pio.h"
+#include "hardware/dma.h"
 #include "spi.pio.h"
 
 typedef struct pio_spi_inst {
     PIO pio;
     uint sm;
     uint cs_pin;
+    int tx_dma;     // DMA channels, -1 until pio_spi_dma_init() is called
+    int rx_dma;
 } pio_spi_inst_t;
 
 void pio_spi_write8_blocking(const pio_spi_inst_t *spi, const uint8_t *src, size_t len);
@@ -23,4 +26,12 @@ void pio_spi_write8_read8_blocking(const pio_spi_inst_t *spi, uint8_t *src, uint
 
 void pio_spi_repeat8_read8_blocking(const pio_spi_inst_t *spi, uint8_t src, uint8_t *dst, size_t len);
 
+void pio_spi_dma_init(pio_spi_inst_t *spi, uint tx_dma, uint rx_dma);
+
+void pio_spi_write8_dma(const pio_spi_inst_t *spi, const uint8_t *src, size_t len);
+
+void pio_spi_read8_dma(const pio_spi_inst_t *spi, uint8_t *dst, size_t len);
+
+bool pio_spi_dma_busy(const pio_spi_inst_t *spi);
+
 #endif
\ No newline at end of file
@@ -9,6 +9,7 @@
 #include "ff.h"
 #include "diskio.h"
 #include <stdio.h>
+#include <string.h>
 
 /*--------------------------------------------------------------------------
 
@@ -54,9 +55,80 @@ DSTATUS Stat = STA_NOINIT;	/* Physical drive status */
 static
 BYTE CardType;			/* Card type flags */
 
+/* Sector cache - a small write-through LRU cache of 512 byte sectors.    */
+/* Single sector reads are served from the cache, and a run of reads of   */
+/* consecutive sectors (streaming a file) reads CACHE_AHEAD sectors more  */
+/* with one CMD18 in the background, so the card is asked once rather     */
+/* than once per sector.                                                  */
+#ifdef PICO2
+#define CACHE_SECTORS	32		/* 16KB cache on an RP2350 */
+#else
+#define CACHE_SECTORS	8		/* 4KB cache on an RP2040 */
+#endif
+#define CACHE_AHEAD		4		/* Sectors read ahead of a sequential read */
+
+/* Background transfers. The read ahead, and writes of up to WRITE_BEHIND */
+/* sectors, are started by disk_read() and disk_write(), which return     */
+/* while the blocks are still moving by DMA. sd_busy() moves them on      */
+/* without waiting - sending the next block, polling for the data token   */
+/* or the end of the card's busy time - so the caller can get on with     */
+/* other work in between. Every disk function sees a transfer through     */
+/* before it uses the card itself.                                        */
+#define WRITE_BEHIND	4		/* Most sectors written in the background */
+
+#define BG_IDLE		0			/* Nothing moving */
+#define BG_TOKEN	1			/* Read ahead - waiting for a data token */
+#define BG_READ		2			/* Read ahead - block moving by DMA */
+#define BG_XMIT		3			/* Write - block moving by DMA */
+#define BG_PROG		4			/* Write - card busy programming a block */
+#define BG_STOP		5			/* Write - card busy after STOP_TRAN */
+
+static
+BYTE CacheData[CACHE_SECTORS][512];	/* Cached sectors */
+
+static
+LBA_t CacheLba[CACHE_SECTORS];	/* Sector number (LBA) of each entry */
+
+static
+DWORD CacheUsed[CACHE_SECTORS];	/* LRU stamp of each entry, 0:Empty */
+
+static
+DWORD CacheClock;				/* Last LRU stamp given out */
+
+static
+LBA_t CacheLast;				/* Last sector read, to spot sequential reads */
+
+static
+DWORD CacheHits, CacheMisses;	/* Cache statistics */
+
+static
+BYTE BgState = BG_IDLE;			/* Background transfer state */
+
+static
+BYTE BgCmd;						/* Command that started it */
+
+static
+LBA_t BgLba;					/* First sector */
+
+static
+UINT BgCount, BgNext;			/* Blocks in it, and the next block */
+
+static
+int BgEntry[WRITE_BEHIND];		/* Cache entries the blocks are written from, */
+								/* or [0] the entry being read into */
+
+static
+uint32_t BgTime;				/* Start of the current wait [ms] */
+
+static
+BYTE BgError;					/* A background write failed - reported by */
+								/* the next disk_write() or CTRL_SYNC      */
+
 pio_spi_inst_t pio_spi = {
 		.pio = SDCARD_PIO,
-		.sm = SDCARD_PIO_SM
+		.sm = SDCARD_PIO_SM,
+		.tx_dma = -1,
+		.rx_dma = -1
 };
 
 static inline uint32_t _millis(void)
@@ -140,6 +212,14 @@ void init_spi(void)
 				SDCARD_PIN_SPI0_MOSI,
 				SDCARD_PIN_SPI0_MISO
 	);
+	pio_spi_dma_init(&pio_spi, SDCARD_DMA_TX, SDCARD_DMA_RX);	/* Data blocks move by DMA */
+}
+
+/* Wait for a DMA transfer to finish */
+static
+void dma_wait (void)
+{
+	while (pio_spi_dma_busy(&pio_spi)) tight_loop_contents();
 }
 
 /* Exchange a byte */
@@ -162,7 +242,8 @@ void rcvr_spi_multi (
 )
 {
 	uint8_t *b = (uint8_t *) buff;
-	pio_spi_repeat8_read8_blocking(&pio_spi, 0xff, b, btr);
+	pio_spi_read8_dma(&pio_spi, b, btr);
+	dma_wait();
 }
 
 
@@ -298,6 +379,278 @@ BYTE send_cmd (		/* Return value: R1 resp (bit7==1:Failed to send) */
 ---------------------------------------------------------------------------*/
 
 
+/*-----------------------------------------------------------------------*/
+/* Sector cache                                                          */
+/*-----------------------------------------------------------------------*/
+
+static
+void cache_reset (void)
+{
+	memset(CacheUsed, 0, sizeof CacheUsed);
+	CacheClock = 0;
+	CacheLast = (LBA_t)-1;
+	CacheHits = CacheMisses = 0;
+}
+
+static
+int cache_find (	/* Entry holding the sector, -1:Not cached */
+	LBA_t sector	/* Sector number (LBA) */
+)
+{
+	int i;
+
+	for (i = 0; i < CACHE_SECTORS; i++) {
+		if (CacheUsed[i] && CacheLba[i] == sector) return i;
+	}
+	return -1;
+}
+
+static
+int cache_victim (void)	/* Empty or least recently used entry */
+{
+	int i, v = 0;
+
+	for (i = 0; i < CACHE_SECTORS; i++) {
+		if (!CacheUsed[i]) return i;
+		if (CacheUsed[i] < CacheUsed[v]) v = i;
+	}
+	return v;
+}
+
+static
+void cache_touch (
+	int i			/* Entry just used */
+)
+{
+	if (++CacheClock == 0) {	/* Stamps wrapped - start again */
+		memset(CacheUsed, 0, sizeof CacheUsed);
+		CacheClock = 1;
+	}
+	CacheUsed[i] = CacheClock;
+}
+
+/* Read a sector into the cache. Returns the entry holding it, -1:Error */
+static
+int cache_fill (
+	LBA_t sector	/* Sector number (LBA) */
+)
+{
+	DWORD ba;
+	int i, first = -1;
+
+	ba = (CardType & CT_BLOCK) ? sector : sector * 512;	/* LBA ot BA conversion (byte addressing cards) */
+
+	i = cache_victim();
+	CacheUsed[i] = 0;
+	if ((send_cmd(CMD17, ba) == 0)	/* READ_SINGLE_BLOCK */
+		&& rcvr_datablock(CacheData[i], 512)) {
+		CacheLba[i] = sector;
+		cache_touch(i);
+		first = i;
+	}
+	deselect();
+
+	return first;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Background transfers                                                  */
+/*-----------------------------------------------------------------------*/
+
+/* Give up on a background transfer */
+static
+void bg_fail (void)
+{
+	UINT n;
+
+	if (BgState >= BG_XMIT) {	/* Write - what the card holds is not known */
+		if (BgState != BG_STOP && BgCmd == CMD25 && wait_ready(500))
+			xchg_spi(0xFD);		/* STOP_TRAN token */
+		for (n = 0; n < BgCount; n++) CacheUsed[BgEntry[n]] = 0;
+		BgError = 1;
+	}
+	else if (BgCmd == CMD18) {	/* Read ahead past the end of the card is not an error */
+		send_cmd(CMD12, 0);		/* STOP_TRANSMISSION */
+	}
+	deselect();
+	BgState = BG_IDLE;
+}
+
+/* Move a background transfer on, without waiting. Returns 1 while it */
+/* is still going, 0 once it has finished.                            */
+static
+int bg_poll (void)
+{
+	BYTE d;
+	int i;
+
+	switch (BgState) {
+	case BG_TOKEN:
+		d = xchg_spi(0xFF);
+		if (d == 0xFF && _millis() < BgTime + 200) return 1;
+		if (d != 0xFE) {		/* Invalid DataStart token or timeout */
+			bg_fail();
+			return 0;
+		}
+		i = cache_find(BgLba + BgNext);	/* Keep a single copy of each sector */
+		if (i < 0) i = cache_victim();
+		CacheUsed[i] = 0;
+		BgEntry[0] = i;
+		pio_spi_read8_dma(&pio_spi, CacheData[i], 512);
+		BgState = BG_READ;
+		return 1;
+
+	case BG_READ:
+		if (pio_spi_dma_busy(&pio_spi)) return 1;
+		xchg_spi(0xFF); xchg_spi(0xFF);	/* Discard CRC */
+		CacheLba[BgEntry[0]] = BgLba + BgNext;
+		cache_touch(BgEntry[0]);
+		if (++BgNext < BgCount) {
+			BgTime = _millis();
+			BgState = BG_TOKEN;
+			return 1;
+		}
+		if (BgCmd == CMD18) send_cmd(CMD12, 0);	/* STOP_TRANSMISSION */
+		deselect();
+		BgState = BG_IDLE;
+		return 0;
+
+	case BG_XMIT:
+		if (pio_spi_dma_busy(&pio_spi)) return 1;
+		xchg_spi(0xFF); xchg_spi(0xFF);	/* CRC (Dummy) */
+		d = xchg_spi(0xFF);				/* Receive data response */
+		if ((d & 0x1F) != 0x05) {		/* Not accepted */
+			bg_fail();
+			return 0;
+		}
+		BgTime = _millis();
+		BgState = BG_PROG;
+		return 1;
+
+	case BG_PROG:
+	case BG_STOP:
+		if (xchg_spi(0xFF) != 0xFF) {	/* Card busy */
+			if (_millis() < BgTime + 500) return 1;
+			bg_fail();
+			return 0;
+		}
+		if (BgNext < BgCount) {			/* Next block of a multiple block write */
+			xchg_spi(0xFC);				/* Data token */
+			pio_spi_write8_dma(&pio_spi, CacheData[BgEntry[BgNext++]], 512);
+			BgState = BG_XMIT;
+			return 1;
+		}
+		if (BgCmd == CMD25 && BgState == BG_PROG) {
+			xchg_spi(0xFD);				/* STOP_TRAN token */
+			xchg_spi(0xFF);				/* Busy starts a byte later */
+			BgTime = _millis();
+			BgState = BG_STOP;
+			return 1;
+		}
+		deselect();
+		BgState = BG_IDLE;
+		return 0;
+
+	default:
+		return 0;
+	}
+}
+
+/* See a background transfer through. A read ahead stops after the */
+/* block it is reading, as the card is needed for something else.  */
+static
+void bg_wait (void)
+{
+	if (BgState <= BG_READ && BgCount > BgNext + 1) BgCount = BgNext + 1;
+	while (bg_poll()) tight_loop_contents();
+}
+
+/* Start reading count sectors from sector into the cache */
+static
+void bg_read (
+	LBA_t sector,	/* Start sector number (LBA) */
+	UINT count		/* Number of sectors to read */
+)
+{
+	DWORD ba;
+
+	ba = (CardType & CT_BLOCK) ? sector : sector * 512;	/* LBA ot BA conversion (byte addressing cards) */
+	BgCmd = (count == 1) ? CMD17 : CMD18;
+	if (send_cmd(BgCmd, ba) != 0) {	/* READ_SINGLE_BLOCK / READ_MULTIPLE_BLOCK */
+		deselect();
+		return;
+	}
+	BgLba = sector;
+	BgCount = count;
+	BgNext = 0;
+	BgTime = _millis();
+	BgState = BG_TOKEN;
+}
+
+/* Start writing count sectors from buff to sector. They are copied into */
+/* the cache and sent from there, so buff can be reused at once. No read */
+/* sees them until the write has finished, and they are dropped if it    */
+/* fails. Returns 0 if the card refused the write.                       */
+static
+int bg_write (
+	const BYTE *buff,	/* Data to be written */
+	LBA_t sector,		/* Start sector number (LBA) */
+	UINT count			/* Number of sectors to write (1..WRITE_BEHIND) */
+)
+{
+	DWORD ba;
+	UINT n;
+	int i;
+
+	for (n = 0; n < count; n++) {
+		i = cache_find(sector + n);
+		if (i < 0) i = cache_victim();
+		memcpy(CacheData[i], buff + n * 512, 512);
+		CacheLba[i] = sector + n;
+		cache_touch(i);			/* Newest, so not the next victim */
+		BgEntry[n] = i;
+	}
+	BgCount = count;
+	BgNext = 1;
+
+	ba = (CardType & CT_BLOCK) ? sector : sector * 512;	/* LBA ot BA conversion (byte addressing cards) */
+	if (count == 1) {
+		BgCmd = CMD24;
+	}
+	else {
+		if (CardType & CT_SDC) send_cmd(ACMD23, count);	/* Predefine number of sectors */
+		BgCmd = CMD25;
+	}
+	if (send_cmd(BgCmd, ba) != 0 || !wait_ready(500)) {	/* WRITE_BLOCK / WRITE_MULTIPLE_BLOCK */
+		for (n = 0; n < count; n++) CacheUsed[BgEntry[n]] = 0;
+		deselect();
+		return 0;
+	}
+	xchg_spi(count == 1 ? 0xFE : 0xFC);	/* Data token */
+	pio_spi_write8_dma(&pio_spi, CacheData[BgEntry[0]], 512);
+	BgState = BG_XMIT;
+
+	return 1;
+}
+
+/* Move a background transfer on. Returns true while it is still going. */
+bool sd_busy (void)
+{
+	return bg_poll() != 0;
+}
+
+/* Get the sector cache hit and miss counts (for diagnostics) */
+void sd_cache_stats (
+	uint32_t *hits,
+	uint32_t *misses
+)
+{
+	*hits = CacheHits;
+	*misses = CacheMisses;
+}
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Initialize disk drive                                                 */
 /*-----------------------------------------------------------------------*/
@@ -311,10 +664,13 @@ DSTATUS disk_initialize (
 	uint32_t t;
 
 	if (drv) return STA_NOINIT;			/* Supports only drive 0 */
+	bg_wait();
+	BgError = 0;
 	init_spi();							/* Initialize SPI */
     sleep_ms(10);
 
 	if (Stat & STA_NODISK) return Stat;	/* Is card existing in the soket? */
+	cache_reset();						/* Card may have changed */
 
 	FCLK_SLOW();
 	CS_LOW();
@@ -384,25 +740,44 @@ DRESULT disk_read (
 	UINT count		/* Number of sectors to read (1..128) */
 )
 {
+	int i;
+
 	if (drv || !count) return RES_PARERR;		/* Check parameter */
 	if (Stat & STA_NOINIT) return RES_NOTRDY;	/* Check if drive is ready */
+	bg_wait();
 
-	if (!(CardType & CT_BLOCK)) sector *= 512;	/* LBA ot BA conversion (byte addressing cards) */
-
-	if (count == 1) {	/* Single sector read */
-		if ((send_cmd(CMD17, sector) == 0)	/* READ_SINGLE_BLOCK */
-			&& rcvr_datablock(buff, 512)) {
-			count = 0;
+	if (count == 1) {	/* Single sector read - through the cache */
+		i = cache_find(sector);
+		if (i >= 0) {
+			CacheHits++;
 		}
-	}
-	else {				/* Multiple sector read */
-		if (send_cmd(CMD18, sector) == 0) {	/* READ_MULTIPLE_BLOCK */
-			do {
-				if (!rcvr_datablock(buff, 512)) break;
-				buff += 512;
-			} while (--count);
-			send_cmd(CMD12, 0);				/* STOP_TRANSMISSION */
+		else {
+			CacheMisses++;
+			i = cache_fill(sector);
+			if (i < 0) return RES_ERROR;
 		}
+		cache_touch(i);
+		memcpy(buff, CacheData[i], 512);
+		/* A sequential read reads ahead in the background, once the */
+		/* sectors it read ahead last time have all been used         */
+		if (sector == CacheLast + 1 && cache_find(sector + 1) < 0)
+			bg_read(sector + 1, CACHE_AHEAD);
+		CacheLast = sector;
+		return RES_OK;
+	}
+
+	/* Multiple sector reads go straight to the buffer, so a large read */
+	/* does not flush the cache. Cached copies are never stale as all   */
+	/* writes go through disk_write().                                  */
+	CacheLast = sector + count - 1;
+	if (!(CardType & CT_BLOCK)) sector *= 512;	/* LBA ot BA conversion (byte addressing cards) */
+
+	if (send_cmd(CMD18, sector) == 0) {	/* READ_MULTIPLE_BLOCK */
+		do {
+			if (!rcvr_datablock(buff, 512)) break;
+			buff += 512;
+		} while (--count);
+		send_cmd(CMD12, 0);				/* STOP_TRANSMISSION */
 	}
 	deselect();
 
@@ -431,7 +806,8 @@ void xmit_spi_multi (
 #ifndef SDCARD_PIO
 	spi_write_blocking(SDCARD_SPI_BUS, b, btx);
 #else
-	pio_spi_write8_blocking(&pio_spi, b, btx);
+	pio_spi_write8_dma(&pio_spi, b, btx);
+	dma_wait();
 #endif
 }
 
@@ -470,9 +846,24 @@ DRESULT disk_write (
 	UINT count			/* Number of sectors to write (1..128) */
 )
 {
+	int i;
+	UINT n;
+	const BYTE *data = buff;	/* Sectors being written ... */
+	LBA_t lba = sector;			/* ... and where, for the cache */
+	UINT total = count;
+
 	if (drv || !count) return RES_PARERR;		/* Check parameter */
 	if (Stat & STA_NOINIT) return RES_NOTRDY;	/* Check drive status */
 	if (Stat & STA_PROTECT) return RES_WRPRT;	/* Check write protect */
+	bg_wait();
+	if (BgError) {		/* An earlier background write failed */
+		BgError = 0;
+		return RES_ERROR;
+	}
+
+	CacheLast = (LBA_t)-1;
+	if (count <= WRITE_BEHIND)	/* Written in the background */
+		return bg_write(buff, sector, count) ? RES_OK : RES_ERROR;
 
 	if (!(CardType & CT_BLOCK)) sector *= 512;	/* LBA ==> BA conversion (byte addressing cards) */
 
@@ -496,6 +887,16 @@ DRESULT disk_write (
 	}
 	deselect();
 
+	/* Write through - cached copies are updated once the card has the */
+	/* data. After an error what the card holds is not known, so they   */
+	/* are dropped instead.                                             */
+	for (n = 0; n < total; n++) {
+		i = cache_find(lba + n);
+		if (i < 0) continue;
+		if (count) CacheUsed[i] = 0;	/* Empty */
+		else memcpy(CacheData[i], data + n * 512, 512);
+	}
+
 	return count ? RES_ERROR : RES_OK;	/* Return result */
 }
 #endif
@@ -518,12 +919,14 @@ DRESULT disk_ioctl (
 
 	if (drv) return RES_PARERR;					/* Check parameter */
 	if (Stat & STA_NOINIT) return RES_NOTRDY;	/* Check if drive is ready */
+	bg_wait();
 
 	res = RES_ERROR;
 
 	switch (cmd) {
 	case CTRL_SYNC :		/* Wait for end of internal write process of the drive */
-		if (_select()) res = RES_OK;
+		if (_select() && !BgError) res = RES_OK;
+		BgError = 0;
 		break;
 
 	case GET_SECTOR_COUNT :	/* Get drive capacity in unit of sector (DWORD) */
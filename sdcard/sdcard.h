@@ -1,8 +1,16 @@
+#include <stdint.h>
+#include <stdbool.h>
+
 #define SDCARD_SPI_BUS    spi1
 
 #define SDCARD_PIO        pio1
 #define SDCARD_PIO_SM        0
 
+/* DMA channels for data blocks - clear of channels 0 and 1, which */
+/* pico_scanvideo_dpi claims for VGA output                        */
+#define SDCARD_DMA_TX       10
+#define SDCARD_DMA_RX       11
+
 #ifdef RC2014RP2040VGA
 
   /* SPI pin assignment for RC2014 RP2040 VGA card */
@@ -22,3 +30,11 @@
   #define SDCARD_PIN_SPI0_MISO 19
 
 #endif
+
+/* Sector cache hit and miss counts since the card was initialised */
+void sd_cache_stats(uint32_t *hits, uint32_t *misses);
+
+/* Move a background sector transfer on without waiting for it. Returns */
+/* true while one is still going. Any disk function sees it through     */
+/* first, so this is only needed to let other work run meanwhile.       */
+bool sd_busy(void);
@@ -0,0 +1,108 @@
+/* Sharp MZ-80K emulator - sd card I/O worker */
+/* Tim Holyoake, 2025                         */
+
+#include "picomz.h"
+
+// Slow sd card work - memory dumps, screenshots, tape preloads and
+// finishing a SAVE - is queued here rather than done at once, so the
+// Z80 is never held up while FatFs searches directories or writes
+// sectors.
+//
+// Requests go into a single producer, single consumer ring: the keyboard
+// handlers and cwrite() add them, and mzsdiotask(), called from the main
+// emulator loop, works through them in order. Only the producer moves
+// sdiohead and only the worker moves sdiotail, so no lock is needed.
+// Each request is a job function that does one small piece of work per
+// call and returns SDIOMORE until it has finished. Jobs report their
+// outcome on the first emulator status line with mzsdiostatus().
+//
+// Two kinds of sd card work are not queued. A screen recording runs
+// for as long as the user wants, so as a job it would hold up every
+// request behind it - mzrecordtask() does its own small pieces of work
+// from the main loop instead. cwrite() writes a tape being saved a few
+// sectors at a time as it fills: SAVE pulses are timed in T-states, so
+// the write costs the Z80 nothing, and a LOAD straight after a SAVE can
+// read the file back without waiting for queued writes.
+
+#define SDIOQSIZE      8             // Requests queued - power of 2
+#define SDIOSLICE      100           // Calls to mzsdiotask() between
+                                     // each piece of work
+
+typedef struct sdioreq {
+  sdiojob job;                       // Job function
+  int16_t arg;                       // Passed to the job function
+} sdioreq;
+
+static sdioreq sdioq[SDIOQSIZE];     // Request ring
+static volatile uint8_t sdiohead=0;  // Requests added
+static volatile uint8_t sdiotail=0;  // Requests finished
+static bool sdiofirst=true;          // Next call is a job's first
+
+/* Show a message on the first emulator status line - used by all */
+/* the sd card work, queued or not. While the tape catalogue is    */
+/* shown the message is kept for when it closes, and also covers   */
+/* the catalogue's top line until it is next redrawn.              */
+void mzsdiostatus(uint8_t* message)
+{
+  uint8_t *status=tapestatusarea();
+  uint8_t spos=EMULINE0;
+  uint8_t mzstr[40];
+  uint8_t len=strlen(message);
+
+  if (len > 40) len=40;
+  memset(status+EMULINE0,0x00,40); // Blank line
+  ascii2mzdisplay(message,mzstr);
+  for (uint8_t i=0; i<len; i++) // Can't use strlen as space is 0x00!
+    status[spos++]=mzstr[i];
+  if (status != mzemustatus)
+    memcpy(mzemustatus+EMULINE0,status+EMULINE0,40);
+
+  return;
+}
+
+/* Queue a job for the worker. Returns false if the queue is full. */
+bool mzsdiorequest(sdiojob job, int16_t arg)
+{
+  sdioreq *req;
+
+  if ((uint8_t)(sdiohead-sdiotail) >= SDIOQSIZE) {
+    SHOW("sd card request queue full\n");
+    mzsdiostatus("sd card busy");
+    return(false);
+  }
+
+  req=&sdioq[sdiohead&(SDIOQSIZE-1)];
+  req->job=job;
+  req->arg=arg;
+  __sync_synchronize();              // Request is complete before it is seen
+  ++sdiohead;
+
+  return(true);
+}
+
+/* Do the next piece of queued sd card work - called from the main loop */
+void mzsdiotask(void)
+{
+  static uint16_t slice=0;
+  sdioreq *req;
+
+  // Sectors still moving to or from the card are seen through a step
+  // at a time, and the next piece of work waits until they have gone,
+  // so the Z80 runs while the DMA and the card do the work
+  if (sd_busy()) return;
+  if (sdiohead == sdiotail) return;
+  if ((++slice) < SDIOSLICE) return;
+  slice=0;
+
+  req=&sdioq[sdiotail&(SDIOQSIZE-1)];
+  if (req->job(req->arg,sdiofirst) == SDIOMORE) {
+    sdiofirst=false;
+    return;
+  }
+
+  sdiofirst=true;
+  __sync_synchronize();              // Finished with the request slot
+  ++sdiotail;
+
+  return;
+}
@@ -0,0 +1,32 @@
+/* Sharp MZ-80K emulator - host tool file helpers                  */
+/* See mzfile.h.                                                   */
+
+#include "picomz.h"
+#include "mzfile.h"
+
+long mzreadfile(const char *tool, const char *fname, uint8_t **data)
+{
+  FILE *fp;
+  long size;
+
+  *data=NULL;
+  fp=fopen(fname,"rb");
+  if (fp == NULL) {
+    fprintf(stderr,"%s: can't open %s\n",tool,fname);
+    return(-1);
+  }
+  fseek(fp,0,SEEK_END);
+  size=ftell(fp);
+  rewind(fp);
+  *data=malloc(size > 0 ? size : 1);
+  if ((*data == NULL) || (fread(*data,1,size,fp) != (size_t) size)) {
+    fprintf(stderr,"%s: can't read %s\n",tool,fname);
+    fclose(fp);
+    free(*data);
+    *data=NULL;
+    return(-1);
+  }
+  fclose(fp);
+
+  return(size);
+}
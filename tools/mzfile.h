@@ -0,0 +1,14 @@
+/* Sharp MZ-80K emulator - host tool file helpers                  */
+/* Shared by the host tools that work on whole tape files.         */
+
+#ifndef MZFILE_H
+#define MZFILE_H
+
+#include <stdint.h>
+
+/* Read a whole file into memory that the caller frees. Errors are */
+/* reported on stderr, prefixed with the tool's name. Returns the  */
+/* file size, or -1 on error.                                      */
+long mzreadfile(const char *tool, const char *fname, uint8_t **data);
+
+#endif
@@ -0,0 +1,115 @@
+/* Sharp MZ-80K emulator - host fuzz harness for tape headers      */
+/* Feeds random and mutated tape headers to mzf_parse() (mzf.h),   */
+/* and random container index entries to mzt_indexok() and         */
+/* mzt_entryok() (mzt.h), checking each answer against a plain     */
+/* 64 bit reference. These are the checks the emulator and the     */
+/* other host tools make before trusting a tape file, so a wrong   */
+/* answer here is a read past the end of a file, flash or memory.  */
+/*                                                                 */
+/* Usage: mzfuzz [iterations [seed]]                               */
+/*                                                                 */
+/* Stops at the first wrong answer, printing the case that failed. */
+
+#include "picomz.h"
+#include "mzt.h"
+#include "mzf.h"
+
+static uint32_t rnd32(void)
+{
+  return(((uint32_t) (rand()&0xFFFF)<<16)|(rand()&0xFFFF));
+}
+
+/* A random number, biased towards the edges where checks go wrong */
+static uint32_t edgy(uint32_t max)
+{
+  switch (rand()%4) {
+    case 0:  return(rand()%16);
+    case 1:  return(max-(rand()%16));
+    case 2:  return(0xFFFFFFFF-(rand()%256));
+    default: return((max == 0xFFFFFFFF) ? rnd32() : rnd32()%(max+1));
+  }
+}
+
+/* Check one tape header. Returns 0, or 1 if mzf_parse() was wrong. */
+static int fuzzheader(const uint8_t *hdr, uint32_t avail)
+{
+  mzfinfo info;
+  uint8_t result=mzf_parse(hdr,avail,&info);
+  uint32_t len=hdr[MZFLENGTH]|(hdr[MZFLENGTH+1]<<8);
+  uint32_t load=hdr[MZFLOAD]|(hdr[MZFLOAD+1]<<8);
+  uint32_t exec=hdr[MZFEXEC]|(hdr[MZFEXEC+1]<<8);
+  uint8_t expect=MZFOK;
+
+  if ((avail != MZFANYSIZE) && (avail < len)) expect=MZFSHORT;
+  else if (hdr[MZFTYPE] == MZFDUMP) expect=MZFOK;
+  else if (len > MZFBODYMAX) expect=MZFBADLENGTH;
+  else if ((hdr[MZFTYPE] == MZFMACHINE) &&
+           ((load < MZFRAMSTART) || (load+len > MZFVRAMEND)))
+    expect=MZFBADLOAD;
+  else if ((hdr[MZFTYPE] == MZFMACHINE) && (exec >= MZFVRAMSTART))
+    expect=MZFBADEXEC;
+
+  if ((result == expect) && (info.bodylen == len) &&
+      (info.hchk == mzf_checksum(hdr,MZFHDRSIZE)))
+    return(0);
+
+  printf("mzf_parse: type 0x%02x length %u load %04x exec %04x avail %u"
+         " - got %d, expected %d\n",hdr[MZFTYPE],(unsigned) len,
+         (unsigned) load,(unsigned) exec,(unsigned) avail,result,expect);
+  return(1);
+}
+
+/* Check one container index. Returns 0, or 1 if mzt_indexok() or */
+/* mzt_entryok() was wrong.                                       */
+static int fuzzentry(uint16_t nprogs, uint32_t offset, uint16_t bodylen,
+                     uint32_t size)
+{
+  bool indexok=mzt_indexok(nprogs,size);
+  bool entryok=mzt_entryok(offset,bodylen,nprogs,size);
+  uint64_t indexend=MZTHDRSIZE+(uint64_t) nprogs*MZTENTRYSIZE;
+  bool indexfits=indexend <= size;
+  bool entryfits=(offset >= indexend) &&
+                 ((uint64_t) offset+MZFHDRSIZE+bodylen <= size);
+
+  if ((indexok == indexfits) && (entryok == entryfits)) return(0);
+
+  printf("mzt: %u programs, offset 0x%08x, length %u, size 0x%08x -"
+         " index %s, entry %s\n",nprogs,(unsigned) offset,bodylen,
+         (unsigned) size,indexok ? "accepted" : "rejected",
+         entryok ? "accepted" : "rejected");
+  return(1);
+}
+
+int main(int argc, char *argv[])
+{
+  long iterations=(argc > 1) ? atol(argv[1]) : 1000000;
+  unsigned seed=(argc > 2) ? (unsigned) atol(argv[2]) : 1;
+  uint8_t hdr[MZFHDRSIZE];
+  uint32_t avail;
+
+  srand(seed);
+  for (long n=0;n<iterations;n++) {
+    // A random header, or a plausible one with a few bits flipped
+    for (int i=0;i<MZFHDRSIZE;i++)
+      hdr[i]=rand()&0xFF;
+    if (n&1) {
+      hdr[MZFTYPE]=(rand()%4) ? MZFMACHINE : MZFDUMP;
+      mzt_put16(&hdr[MZFLENGTH],0x1000);
+      mzt_put16(&hdr[MZFLOAD],0x1200);
+      mzt_put16(&hdr[MZFEXEC],0x1200);
+      for (int flips=rand()%4;flips>0;flips--)
+        hdr[MZFLENGTH+rand()%6]^=1<<(rand()%8);
+    }
+    avail=(rand()%8) ? edgy(0x10000) : MZFANYSIZE;
+
+    if (fuzzheader(hdr,avail) ||
+        fuzzentry(edgy(0xFFFF),edgy(0xFFFFFFFF),edgy(0xFFFF),
+                  edgy(0xFFFFFFFF))) {
+      printf("mzfuzz: failed at iteration %ld, seed %u\n",n,seed);
+      return(1);
+    }
+  }
+
+  printf("mzfuzz: %ld iterations, seed %u - no failures\n",iterations,seed);
+  return(0);
+}
@@ -0,0 +1,249 @@
+/* Sharp MZ-80K emulator - host tape file packer                   */
+/* Compresses .mzf tape files to .mzc files (see mzc.h), which the */
+/* emulator decompresses as the tape is read. With -d, turns .mzc  */
+/* files back into .mzf files.                                     */
+/*                                                                 */
+/* Usage: mzpack [-d] file ...                                     */
+/*                                                                 */
+/* GAME.MZF is written to GAME.MZC, and with -d GAME.MZC is        */
+/* written to GAME.MZF - any other file name has .mzc or .mzf      */
+/* added to it.                                                    */
+
+#include <ctype.h>
+#include <strings.h>
+#include "picomz.h"
+#include "mzc.h"
+#include "mzf.h"
+#include "mzfile.h"
+
+#define HASHSIZE        (1<<14)        // Match finder hash table
+#define MAXCHAIN        256            // Most window positions tried
+
+/* Output file name - the extension is replaced if it is from, */
+/* otherwise to is added                                       */
+static void outname(const char *fname, const char *from, const char *to,
+                    char *out)
+{
+  size_t len=strlen(fname);
+
+  snprintf(out,FILENAME_MAX,"%s",fname);
+  if ((len > 4) && (strcasecmp(&fname[len-4],from) == 0)) {
+    // Keep the case of the original extension
+    for (int i=1;i<4;i++)
+      out[len-4+i]=isupper((uint8_t) fname[len-4+i]) ?
+                   toupper(to[i]) : tolower(to[i]);
+  }
+  else
+    snprintf(out,FILENAME_MAX,"%s%s",fname,to);
+  return;
+}
+
+static uint16_t hash3(const uint8_t *p)
+{
+  return(((p[0]<<6)^(p[1]<<3)^p[2])&(HASHSIZE-1));
+}
+
+/* Compress len bytes to out, which must hold len*9/8+2 bytes. */
+/* Returns the compressed size.                                */
+static long compress(const uint8_t *in, long len, uint8_t *out)
+{
+  static int32_t head[HASHSIZE];
+  int32_t *prev;
+  long pos=0, outpos=0, flagpos=0, best, bestdist, n, cand;
+  int items=8;
+
+  prev=malloc((len > 0 ? len : 1)*sizeof(int32_t));
+  if (prev == NULL) return(-1);
+  for (int i=0;i<HASHSIZE;i++) head[i]=-1;
+
+  while (pos < len) {
+    if (items == 8) {                  // Start a new flag byte
+      flagpos=outpos++;
+      out[flagpos]=0;
+      items=0;
+    }
+
+    // Longest match in the window, newest first
+    best=0;
+    bestdist=0;
+    if (pos+MZCMINMATCH <= len) {
+      cand=head[hash3(&in[pos])];
+      for (int tries=0;(cand >= 0)&&(pos-cand <= MZCWINDOW)&&
+                       (tries < MAXCHAIN);tries++) {
+        for (n=0;(n < MZCMAXMATCH)&&(pos+n < len)&&
+                 (in[cand+n] == in[pos+n]);n++);
+        if (n > best) {
+          best=n;
+          bestdist=pos-cand;
+          if (best == MZCMAXMATCH) break;
+        }
+        cand=prev[cand];
+      }
+    }
+
+    if (best >= MZCMINMATCH) {
+      out[outpos++]=(bestdist-1)&0xFF;
+      out[outpos++]=(((bestdist-1)>>8)<<4)|(best-MZCMINMATCH);
+    }
+    else {
+      out[flagpos]|=1<<items;
+      out[outpos++]=in[pos];
+      best=1;
+    }
+    ++items;
+
+    // Add every position passed over to the match finder
+    for (n=0;n<best;n++,pos++) {
+      if (pos+MZCMINMATCH <= len) {
+        prev[pos]=head[hash3(&in[pos])];
+        head[hash3(&in[pos])]=pos;
+      }
+    }
+  }
+  free(prev);
+
+  return(outpos);
+}
+
+/* Write a file from one or two parts - part2 may be NULL if len2 */
+/* is 0. Returns 0, or 1 on error.                                 */
+static int writefile(const char *fname, const uint8_t *part1, long len1,
+                     const uint8_t *part2, long len2)
+{
+  FILE *fp;
+
+  fp=fopen(fname,"wb");
+  if (fp == NULL) {
+    fprintf(stderr,"mzpack: can't create %s\n",fname);
+    return(1);
+  }
+  fwrite(part1,1,len1,fp);
+  if (len2 > 0) fwrite(part2,1,len2,fp);
+  fclose(fp);
+
+  return(0);
+}
+
+/* Compress a .mzf file. Returns 0, or 1 on error. */
+static int pack(const char *fname)
+{
+  uint8_t *mzf, *out;
+  uint8_t hdr[MZCHDRSIZE+TAPEHEADERSIZE];
+  char oname[FILENAME_MAX];
+  long size, bodylen, packed;
+  uint8_t result;
+  mzfinfo info;
+  int failed;
+
+  size=mzreadfile("mzpack",fname,&mzf);
+  if (size < 0) return(1);
+  result=(size < TAPEHEADERSIZE) ? MZFSHORT :
+         mzf_parse(mzf,size-TAPEHEADERSIZE,&info);
+  if (result != MZFOK) {
+    fprintf(stderr,"mzpack: %s is not a tape file - %s\n",fname,
+            (size < TAPEHEADERSIZE) ? "no tape header" : mzf_error(result));
+    free(mzf);
+    return(1);
+  }
+  bodylen=info.bodylen;
+
+  out=malloc(bodylen*9/8+2);
+  packed=(out != NULL) ? compress(&mzf[TAPEHEADERSIZE],bodylen,out) : -1;
+  if (packed < 0) {
+    fprintf(stderr,"mzpack: out of memory\n");
+    free(mzf);
+    free(out);
+    return(1);
+  }
+
+  memcpy(hdr,MZCMAGIC,4);
+  hdr[4]=(TAPEHEADERSIZE+bodylen)&0xFF;
+  hdr[5]=((TAPEHEADERSIZE+bodylen)>>8)&0xFF;
+  hdr[6]=0;
+  hdr[7]=0;
+  memcpy(&hdr[MZCHDRSIZE],mzf,TAPEHEADERSIZE);
+
+  outname(fname,".mzf",".mzc",oname);
+  failed=writefile(oname,hdr,sizeof(hdr),out,packed);
+  if (!failed)
+    printf("%s: body %ld bytes, compressed to %ld (%ld%%)\n",oname,bodylen,
+           packed,bodylen ? (packed*100)/bodylen : 100);
+  free(mzf);
+  free(out);
+
+  return(failed);
+}
+
+/* Decompress a .mzc file. Returns 0, or 1 on error. */
+static int unpack(const char *fname)
+{
+  static mzcstate state;
+  uint8_t *mzc, *out;
+  char oname[FILENAME_MAX];
+  long size, imagelen;
+  uint32_t used, made;
+  int failed;
+
+  size=mzreadfile("mzpack",fname,&mzc);
+  if (size < 0) return(1);
+  if ((size < MZCHDRSIZE+TAPEHEADERSIZE) || memcmp(mzc,MZCMAGIC,4)) {
+    fprintf(stderr,"mzpack: %s is not a compressed tape file\n",fname);
+    free(mzc);
+    return(1);
+  }
+  if (!mzc_sizeok(mzc,&mzc[MZCHDRSIZE])) {
+    fprintf(stderr,"mzpack: %s is corrupt - image size does not match its"
+            " tape header\n",fname);
+    free(mzc);
+    return(1);
+  }
+  imagelen=mzc[4]|(mzc[5]<<8)|(mzc[6]<<16)|((long) mzc[7]<<24);
+
+  out=malloc(imagelen);
+  if (out == NULL) {
+    free(mzc);
+    return(1);
+  }
+  memcpy(out,&mzc[MZCHDRSIZE],TAPEHEADERSIZE);
+  mzc_init(&state);
+  used=mzc_decode(&state,&mzc[MZCHDRSIZE+TAPEHEADERSIZE],
+                  size-MZCHDRSIZE-TAPEHEADERSIZE,&out[TAPEHEADERSIZE],
+                  imagelen-TAPEHEADERSIZE,&made);
+  if ((made != imagelen-TAPEHEADERSIZE) ||
+      (used != size-MZCHDRSIZE-TAPEHEADERSIZE)) {
+    fprintf(stderr,"mzpack: %s is corrupt\n",fname);
+    free(mzc);
+    free(out);
+    return(1);
+  }
+
+  outname(fname,".mzc",".mzf",oname);
+  failed=writefile(oname,out,imagelen,NULL,0);
+  if (!failed)
+    printf("%s: %ld bytes\n",oname,imagelen);
+  free(mzc);
+  free(out);
+
+  return(failed);
+}
+
+int main(int argc, char *argv[])
+{
+  bool decompress=false;
+  int argn=1, failed=0;
+
+  if ((argn < argc) && (strcmp(argv[argn],"-d") == 0)) {
+    decompress=true;
+    ++argn;
+  }
+  if (argn >= argc) {
+    fprintf(stderr,"Usage: mzpack [-d] file ...\n");
+    fprintf(stderr,"  -d   decompress .mzc files to .mzf files\n");
+    return(1);
+  }
+
+  for (;argn<argc;argn++)
+    failed+=decompress ? unpack(argv[argn]) : pack(argv[argn]);
+
+  return(failed ? 1 : 0);
+}
@@ -0,0 +1,273 @@
+/* Sharp MZ-80K emulator - host screen recording player             */
+/* Plays back a screen recording (RECnnnn.MZV, saved with Scroll   */
+/* Lock) using the same character ROM and glyph expansion code as  */
+/* the VGA output (vgadisplay.c).                                  */
+/*                                                                 */
+/* Usage: mzplay [-t theme] [-r] [-p] file ...                     */
+/*                                                                 */
+/* Each recording is written to file.gif as an animated GIF, or    */
+/* with -p to file.ppm as a stream of PPM images at the recording  */
+/* frame rate, for video tools such as ffmpeg:                     */
+/*                                                                 */
+/*   ffmpeg -framerate 60 -f image2pipe -i REC0000.MZV.ppm out.mp4 */
+
+#include "picomz.h"
+#include "mzglyph.h"
+#include "mzrec.h"
+
+#define PWIDTH          (MZRCOLS*MZGWIDTH)   // 320 pixels per scanline
+#define PLINES          (MZRROWS*MZGHEIGHT)  // 200 scanlines
+#define GIFCODEBITS     2                    // GIF minimum LZW code size
+#define GIFMAXCODE      4095
+
+static uint32_t lut[16][2];             // Pixel lookup table - pixels are
+                                        // 0 (background) or 1 (foreground)
+static uint8_t rgbpal[2][3];            // RGB8 colours for pixels 0 and 1
+static uint8_t pixels[PWIDTH*PLINES];   // Current frame as palette indices
+
+/* Render a 1000 byte screen to palette indices */
+static void renderscreen(const uint8_t *screen)
+{
+  uint32_t words[PWIDTH/2];
+  uint16_t *wpix=(uint16_t *) words;
+  uint8_t *out=pixels;
+
+  for (int row=0;row<MZRROWS;row++) {
+    for (int cpixrow=0;cpixrow<MZGHEIGHT;cpixrow++) {
+      mzglyph_row(words,screen+row*MZRCOLS,cgrom+cpixrow,lut);
+      for (int x=0;x<PWIDTH;x++)
+        *out++=wpix[x];
+    }
+  }
+  return;
+}
+
+/* GIF output - LZW codes are packed into 255 byte sub-blocks */
+static uint8_t gifblock[256];
+static int gifblen;
+static uint32_t gifbits;
+static int gifnbits;
+
+static void gifcode(FILE *fp, int code, int size)
+{
+  gifbits|=(uint32_t) code<<gifnbits;
+  gifnbits+=size;
+  while (gifnbits >= 8) {
+    gifblock[1+gifblen++]=gifbits&0xFF;
+    gifbits>>=8;
+    gifnbits-=8;
+    if (gifblen == 255) {
+      gifblock[0]=255;
+      fwrite(gifblock,1,256,fp);
+      gifblen=0;
+    }
+  }
+  return;
+}
+
+static void gifput16(FILE *fp, int value)
+{
+  fputc(value&0xFF,fp);
+  fputc((value>>8)&0xFF,fp);
+  return;
+}
+
+static void gifheader(FILE *fp)
+{
+  fwrite("GIF89a",1,6,fp);
+  gifput16(fp,PWIDTH);
+  gifput16(fp,PLINES);
+  fputc(0x80,fp);                       // 2 colour global colour table
+  fputc(0,fp);
+  fputc(0,fp);
+  fwrite(rgbpal,1,6,fp);
+  // Loop forever
+  fwrite("\x21\xFF\x0BNETSCAPE2.0\x03\x01\x00\x00\x00",1,19,fp);
+  return;
+}
+
+/* Write the current frame, shown for delay hundredths of a second */
+static void gifframe(FILE *fp, int delay)
+{
+  static uint16_t trie[GIFMAXCODE+1][1<<GIFCODEBITS];
+  int clear=1<<GIFCODEBITS;
+  int size=GIFCODEBITS+1;
+  int next=clear+2;
+  int prefix;
+
+  fwrite("\x21\xF9\x04\x00",1,4,fp);    // Graphic control extension
+  gifput16(fp,delay);
+  fputc(0,fp);
+  fputc(0,fp);
+  fputc(0x2C,fp);                       // Image descriptor
+  gifput16(fp,0);
+  gifput16(fp,0);
+  gifput16(fp,PWIDTH);
+  gifput16(fp,PLINES);
+  fputc(0,fp);
+  fputc(GIFCODEBITS,fp);
+
+  gifblen=0;
+  gifbits=0;
+  gifnbits=0;
+  memset(trie,0,sizeof(trie));
+  gifcode(fp,clear,size);
+  prefix=pixels[0];
+  for (int i=1;i<PWIDTH*PLINES;i++) {
+    if (trie[prefix][pixels[i]]) {
+      prefix=trie[prefix][pixels[i]];
+      continue;
+    }
+    gifcode(fp,prefix,size);
+    if (next < GIFMAXCODE) {
+      trie[prefix][pixels[i]]=next++;
+      if ((next > (1<<size)) && (size < 12)) ++size;
+    }
+    else {                              // Table full - start again
+      gifcode(fp,clear,size);
+      memset(trie,0,sizeof(trie));
+      size=GIFCODEBITS+1;
+      next=clear+2;
+    }
+    prefix=pixels[i];
+  }
+  gifcode(fp,prefix,size);
+  gifcode(fp,clear+1,size);             // End of information
+  if (gifnbits) gifcode(fp,0,8-gifnbits);
+  if (gifblen) {
+    gifblock[0]=gifblen;
+    fwrite(gifblock,1,gifblen+1,fp);
+  }
+  fputc(0,fp);
+  return;
+}
+
+/* Write the current frame ticks times as PPM images */
+static void ppmframe(FILE *fp, int ticks)
+{
+  static uint8_t rgb[PWIDTH*PLINES*3];
+
+  for (int i=0;i<PWIDTH*PLINES;i++)
+    memcpy(&rgb[i*3],rgbpal[pixels[i]],3);
+  while (ticks-- > 0) {
+    fprintf(fp,"P6\n%d %d\n255\n",PWIDTH,PLINES);
+    fwrite(rgb,1,sizeof(rgb),fp);
+  }
+  return;
+}
+
+/* Play one recording. Returns the number of frames, or -1 on error. */
+static int play(const char *fname, bool ppm)
+{
+  uint8_t screen[MZRCHARS];
+  char outname[FILENAME_MAX];
+  uint8_t *rec;
+  long size;
+  int pos, used, frames=0, rate;
+  long ticks=0, shown=0;
+  FILE *fp;
+
+  fp=fopen(fname,"rb");
+  if (fp == NULL) {
+    fprintf(stderr,"mzplay: can't open %s\n",fname);
+    return(-1);
+  }
+  fseek(fp,0,SEEK_END);
+  size=ftell(fp);
+  rewind(fp);
+  rec=malloc(size > 0 ? size : 1);
+  if ((rec == NULL) || (fread(rec,1,size,fp) != (size_t) size) ||
+      (size < MZRHDRSIZE) || memcmp(rec,MZRMAGIC,4) ||
+      (rec[5] != MZRCOLS) || (rec[6] != MZRROWS) || (rec[4] == 0)) {
+    fprintf(stderr,"mzplay: %s is not a screen recording\n",fname);
+    fclose(fp);
+    free(rec);
+    return(-1);
+  }
+  fclose(fp);
+  rate=rec[4];
+
+  snprintf(outname,sizeof(outname),"%s.%s",fname,ppm?"ppm":"gif");
+  fp=fopen(outname,"wb");
+  if (fp == NULL) {
+    fprintf(stderr,"mzplay: can't create %s\n",outname);
+    free(rec);
+    return(-1);
+  }
+  if (!ppm) gifheader(fp);
+
+  // Each frame is written once the time to the next one is known
+  memset(screen,0x00,MZRCHARS);
+  pos=MZRHDRSIZE;
+  while (pos+2 <= size) {
+    if ((rec[pos] != MZRKEY) && (rec[pos] != MZRDELTA)) break;
+    if ((rec[pos] == MZRDELTA) && (frames == 0)) break; // Needs a key frame
+    if (frames) {
+      ticks+=rec[pos+1];
+      if (ppm)
+        ppmframe(fp,rec[pos+1]);
+      else {
+        // GIF delays are in hundredths - keep in step with the recording
+        gifframe(fp,(ticks*100)/rate-shown);
+        shown=(ticks*100)/rate;
+      }
+    }
+    if (rec[pos] == MZRKEY) memset(screen,0x00,MZRCHARS);
+    used=mzrec_apply(screen,&rec[pos+2],size-pos-2);
+    if (used < 0) break;
+    renderscreen(screen);
+    ++frames;
+    pos+=used+2;
+  }
+  if (pos != size)
+    fprintf(stderr,"mzplay: %s is corrupt at byte %d\n",fname,pos);
+  if (frames) {
+    if (ppm)
+      ppmframe(fp,rate);               // Hold the last frame for a second
+    else
+      gifframe(fp,100);
+  }
+  if (!ppm) fputc(0x3B,fp);            // GIF trailer
+  fclose(fp);
+  free(rec);
+
+  printf("%s: %d frames, %ld seconds\n",outname,frames,ticks/rate);
+  return(frames);
+}
+
+int main(int argc, char *argv[])
+{
+  uint8_t theme=0;
+  bool reverse=false, ppm=false;
+  int argn=1, failed=0;
+
+  while ((argn < argc) && (argv[argn][0] == '-')) {
+    if ((strcmp(argv[argn],"-t") == 0) && (argn+1 < argc))
+      theme=atoi(argv[++argn])%MZGTHEMES;
+    else if (strcmp(argv[argn],"-r") == 0)
+      reverse=true;
+    else if (strcmp(argv[argn],"-p") == 0)
+      ppm=true;
+    else
+      break;
+    ++argn;
+  }
+  if (argn >= argc) {
+    fprintf(stderr,"Usage: mzplay [-t theme] [-r] [-p] file ...\n");
+    fprintf(stderr,"  -t theme   0 white (default), 1 green, 2 amber\n");
+    fprintf(stderr,"  -r         reverse video\n");
+    fprintf(stderr,"  -p         write a PPM stream instead of a GIF\n");
+    return(1);
+  }
+
+  // Pixels are rendered as palette indices, converted to RGB on output
+  mzglyph_lut(lut,1,0);
+  memcpy(rgbpal[reverse?0:1],mzgthemes[theme][0],3);
+  memcpy(rgbpal[reverse?1:0],mzgthemes[theme][1],3);
+
+  for (;argn<argc;argn++)
+    if (play(argv[argn],ppm) < 0)
+      ++failed;
+
+  return(failed ? 1 : 0);
+}
@@ -0,0 +1,155 @@
+/* Sharp MZ-80K emulator - host screen renderer                    */
+/* Renders MZ-80K video RAM to PPM images using the same character */
+/* ROM and glyph expansion code as the VGA output (vgadisplay.c).  */
+/*                                                                 */
+/* Usage: mzrender [-t theme] [-r] [-s status] file ...            */
+/*                                                                 */
+/* Each file is either a raw VRAM image (1000 or 1024 bytes) or a  */
+/* Pico MZ-80K memory dump (MZDUMP.MZF, saved with F12). The image */
+/* is written to file.ppm - 320x200, or 320x240 if a 200 byte      */
+/* emulator status area file is given with -s. Many files can be   */
+/* rendered in one run, so whole software libraries can be        */
+/* compared against known good screenshots.                        */
+
+#include "picomz.h"
+#include "mzglyph.h"
+
+#define DWIDTH          40     // MZ-80K display is 40 chars x 25 lines
+#define DLINES          25
+#define DVISIBLE        (DWIDTH*DLINES)
+#define SLINES          5      // Emulator status area is 40 x 5
+#define PWIDTH          (DWIDTH*MZGWIDTH)  // 320 pixels per scanline
+#define DUMPSIZE        (TAPEHEADERSIZE+URAMSIZE+VRAMSIZE)
+
+static uint32_t lut[16][2];             // Pixel lookup table - pixels are
+                                        // 0 (background) or 1 (foreground)
+static uint8_t rgbpal[2][3];            // RGB8 colours for pixels 0 and 1
+
+/* Read the visible VRAM from a raw VRAM image or memory dump */
+static int readvram(const char *fname, uint8_t *vram)
+{
+  FILE *fp;
+  long size;
+  uint8_t hdr;
+
+  fp=fopen(fname,"rb");
+  if (fp == NULL) {
+    fprintf(stderr,"mzrender: can't open %s\n",fname);
+    return(-1);
+  }
+  fseek(fp,0,SEEK_END);
+  size=ftell(fp);
+  rewind(fp);
+
+  if ((size >= DUMPSIZE) && (fread(&hdr,1,1,fp) == 1) && (hdr == 0x20)) {
+    // Memory dump - 128 byte header, user RAM, then VRAM
+    fseek(fp,TAPEHEADERSIZE+URAMSIZE,SEEK_SET);
+  }
+  else if ((size == DVISIBLE) || (size == VRAMSIZE)) {
+    rewind(fp);
+  }
+  else {
+    fprintf(stderr,"mzrender: %s is not a VRAM image or memory dump\n",fname);
+    fclose(fp);
+    return(-1);
+  }
+
+  if (fread(vram,1,DVISIBLE,fp) != DVISIBLE) {
+    fprintf(stderr,"mzrender: short read from %s\n",fname);
+    fclose(fp);
+    return(-1);
+  }
+  fclose(fp);
+
+  return(0);
+}
+
+/* Render rows of 40 display codes, appending RGB pixels to out */
+static uint8_t *renderrows(uint8_t *out, const uint8_t *chars, int rows)
+{
+  uint32_t words[PWIDTH/2];
+  uint16_t *pixels=(uint16_t *) words;
+
+  for (int row=0;row<rows;row++) {
+    for (int cpixrow=0;cpixrow<MZGHEIGHT;cpixrow++) {
+      mzglyph_row(words,chars+row*DWIDTH,cgrom+cpixrow,lut);
+      for (int x=0;x<PWIDTH;x++) {
+        const uint8_t *rgb=rgbpal[pixels[x]];
+        *out++=rgb[0];
+        *out++=rgb[1];
+        *out++=rgb[2];
+      }
+    }
+  }
+  return(out);
+}
+
+int main(int argc, char *argv[])
+{
+  static uint8_t frame[PWIDTH*(DLINES+SLINES)*MZGHEIGHT*3];
+  uint8_t vram[DVISIBLE];
+  uint8_t status[EMUSSIZE];
+  const char *statusfile=NULL;
+  char outname[FILENAME_MAX];
+  uint8_t theme=0;
+  bool reverse=false;
+  int argn=1, lines, failed=0;
+  FILE *fp;
+
+  while ((argn < argc) && (argv[argn][0] == '-')) {
+    if ((strcmp(argv[argn],"-t") == 0) && (argn+1 < argc))
+      theme=atoi(argv[++argn])%MZGTHEMES;
+    else if (strcmp(argv[argn],"-r") == 0)
+      reverse=true;
+    else if ((strcmp(argv[argn],"-s") == 0) && (argn+1 < argc))
+      statusfile=argv[++argn];
+    else
+      break;
+    ++argn;
+  }
+  if (argn >= argc) {
+    fprintf(stderr,"Usage: mzrender [-t theme] [-r] [-s status] file ...\n");
+    fprintf(stderr,"  -t theme   0 white (default), 1 green, 2 amber\n");
+    fprintf(stderr,"  -r         reverse video\n");
+    fprintf(stderr,"  -s status  200 byte status area - output 320x240\n");
+    return(1);
+  }
+
+  if (statusfile) {
+    fp=fopen(statusfile,"rb");
+    if ((fp == NULL) || (fread(status,1,EMUSSIZE,fp) != EMUSSIZE)) {
+      fprintf(stderr,"mzrender: can't read status area %s\n",statusfile);
+      return(1);
+    }
+    fclose(fp);
+  }
+
+  // Pixels are rendered as palette indices, converted to RGB on output
+  mzglyph_lut(lut,1,0);
+  memcpy(rgbpal[reverse?0:1],mzgthemes[theme][0],3);
+  memcpy(rgbpal[reverse?1:0],mzgthemes[theme][1],3);
+
+  lines=(statusfile ? DLINES+SLINES : DLINES)*MZGHEIGHT;
+  for (;argn<argc;argn++) {
+    if (readvram(argv[argn],vram)) {
+      ++failed;
+      continue;
+    }
+    uint8_t *out=renderrows(frame,vram,DLINES);
+    if (statusfile)
+      renderrows(out,status,SLINES);
+
+    snprintf(outname,sizeof(outname),"%s.ppm",argv[argn]);
+    fp=fopen(outname,"wb");
+    if (fp == NULL) {
+      fprintf(stderr,"mzrender: can't create %s\n",outname);
+      ++failed;
+      continue;
+    }
+    fprintf(fp,"P6\n%d %d\n255\n",PWIDTH,lines);
+    fwrite(frame,1,PWIDTH*lines*3,fp);
+    fclose(fp);
+  }
+
+  return(failed ? 1 : 0);
+}
@@ -0,0 +1,207 @@
+/* Sharp MZ-80K emulator - host tape container tool                */
+/* Packs .mzf tape files into a multi-program tape container       */
+/* (.mzt, see mzt.h), and lists or unpacks containers.             */
+/*                                                                 */
+/* Usage: mzt -c container.mzt file.mzf ...   pack                 */
+/*        mzt -l container.mzt ...            list                 */
+/*        mzt -x container.mzt ...            unpack               */
+/*                                                                 */
+/* Programs are played in the order they are packed. Unpacking     */
+/* writes each program to nnn-NAME.mzf, where nnn is its position  */
+/* in the container and NAME comes from its tape header.           */
+
+#include <ctype.h>
+#include "picomz.h"
+#include "mzt.h"
+#include "mzf.h"
+#include "mzfile.h"
+
+/* Write zeros up to the next multiple of MZTALIGN */
+static long pad(FILE *fp, long pos)
+{
+  while (pos%MZTALIGN) {
+    fputc(0,fp);
+    ++pos;
+  }
+  return(pos);
+}
+
+/* Pack .mzf files into a container. Returns 0, or 1 on error - */
+/* when nothing is left of the container, as its header and      */
+/* index are written before the tape files are read.             */
+static int pack(const char *mztname, int nfiles, char *fnames[])
+{
+  uint8_t hdr[MZTHDRSIZE];
+  uint8_t *index;
+  uint8_t *mzf;
+  long size,pos;
+  uint16_t bodylen;
+  uint8_t result;
+  mzfinfo info;
+  FILE *fp;
+
+  if (nfiles > MZTMAXPROGS) {
+    fprintf(stderr,"mzt: at most %d programs in a container\n",MZTMAXPROGS);
+    return(1);
+  }
+
+  fp=fopen(mztname,"wb");
+  if (fp == NULL) {
+    fprintf(stderr,"mzt: can't create %s\n",mztname);
+    return(1);
+  }
+  index=calloc(nfiles,MZTENTRYSIZE);
+  if (index == NULL) {
+    fclose(fp);
+    remove(mztname);
+    return(1);
+  }
+
+  // Header and index first - the index is rewritten once it is known
+  memset(hdr,0,MZTHDRSIZE);
+  memcpy(hdr,MZTMAGIC,4);
+  mzt_put16(&hdr[4],nfiles);
+  fwrite(hdr,1,MZTHDRSIZE,fp);
+  fwrite(index,MZTENTRYSIZE,nfiles,fp);
+  pos=MZTHDRSIZE+(long) nfiles*MZTENTRYSIZE;
+
+  for (int i=0;i<nfiles;i++) {
+    size=mzreadfile("mzt",fnames[i],&mzf);
+    if (size < 0) {
+      fclose(fp);
+      remove(mztname);
+      free(index);
+      return(1);
+    }
+    result=(size < TAPEHEADERSIZE) ? MZFSHORT :
+           mzf_parse(mzf,size-TAPEHEADERSIZE,&info);
+    if (result != MZFOK) {
+      fprintf(stderr,"mzt: %s is not a tape file - %s\n",fnames[i],
+              (size < TAPEHEADERSIZE) ? "no tape header" : mzf_error(result));
+      fclose(fp);
+      remove(mztname);
+      free(mzf);
+      free(index);
+      return(1);
+    }
+    bodylen=info.bodylen;
+
+    pos=pad(fp,pos);
+    mzt_put32(&index[i*MZTENTRYSIZE+MZTOFFSET],pos);
+    mzt_put16(&index[i*MZTENTRYSIZE+MZTLENGTH],bodylen);
+    index[i*MZTENTRYSIZE+MZTTYPE]=mzf[0];
+    memcpy(&index[i*MZTENTRYSIZE+MZTNAME],&mzf[1],17);
+    fwrite(mzf,1,TAPEHEADERSIZE+bodylen,fp);
+    pos+=TAPEHEADERSIZE+bodylen;
+    free(mzf);
+  }
+  pad(fp,pos);
+
+  fseek(fp,MZTHDRSIZE,SEEK_SET);
+  fwrite(index,MZTENTRYSIZE,nfiles,fp);
+  fclose(fp);
+  free(index);
+
+  printf("%s: %d programs\n",mztname,nfiles);
+  return(0);
+}
+
+/* Copy a tape header file name to ASCII that is safe in a file name */
+static void safename(const uint8_t *hname, char *name)
+{
+  int i;
+
+  for (i=0;(i<17)&&(hname[i]!=0x0D);i++)
+    name[i]=isalnum(hname[i]) ? hname[i] : '_';
+  name[i]='\0';
+  return;
+}
+
+/* List or unpack a container. Returns 0, or 1 on error. */
+static int unpack(const char *mztname, bool extract)
+{
+  uint8_t *mzt;
+  const uint8_t *entry;
+  char name[18],outname[FILENAME_MAX];
+  long size;
+  uint32_t offset;
+  uint16_t nprogs,bodylen;
+  uint8_t result;
+  mzfinfo info;
+  FILE *fp;
+
+  size=mzreadfile("mzt",mztname,&mzt);
+  if (size < 0) return(1);
+  nprogs=(size >= MZTHDRSIZE) ? mzt_get16(&mzt[4]) : 0;
+  if ((size < MZTHDRSIZE) || memcmp(mzt,MZTMAGIC,4) ||
+      !mzt_indexok(nprogs,size)) {
+    fprintf(stderr,"mzt: %s is not a tape container\n",mztname);
+    free(mzt);
+    return(1);
+  }
+
+  for (int i=0;i<nprogs;i++) {
+    entry=&mzt[MZTHDRSIZE+i*MZTENTRYSIZE];
+    offset=mzt_get32(&entry[MZTOFFSET]);
+    bodylen=mzt_get16(&entry[MZTLENGTH]);
+    safename(&entry[MZTNAME],name);
+    if (!mzt_entryok(offset,bodylen,nprogs,size)) {
+      fprintf(stderr,"mzt: %s program %d has a bad index entry\n",
+              mztname,i);
+      free(mzt);
+      return(1);
+    }
+    result=mzf_parse(&mzt[offset],bodylen,&info);
+
+    if (!extract) {
+      printf("%3d  type 0x%02x  %5d bytes  load %04x  exec %04x  %s%s%s\n",
+             i,entry[MZTTYPE],bodylen,info.loadaddr,info.execaddr,name,
+             (result != MZFOK) ? " - " : "",
+             (result != MZFOK) ? mzf_error(result) : "");
+      continue;
+    }
+
+    snprintf(outname,sizeof(outname),"%03d-%s.mzf",i,name);
+    fp=fopen(outname,"wb");
+    if (fp == NULL) {
+      fprintf(stderr,"mzt: can't create %s\n",outname);
+      free(mzt);
+      return(1);
+    }
+    fwrite(&mzt[offset],1,TAPEHEADERSIZE+bodylen,fp);
+    fclose(fp);
+    printf("%s\n",outname);
+  }
+  free(mzt);
+
+  return(0);
+}
+
+int main(int argc, char *argv[])
+{
+  int failed=0;
+
+  if ((argc < 3) || (argv[1][0] != '-') || (argv[1][1] == '\0') ||
+      (strchr("clx",argv[1][1]) == NULL) || (argv[1][2] != '\0')) {
+    fprintf(stderr,"Usage: mzt -c container.mzt file.mzf ...\n");
+    fprintf(stderr,"       mzt -l container.mzt ...\n");
+    fprintf(stderr,"       mzt -x container.mzt ...\n");
+    fprintf(stderr,"  -c   pack tape files into a container\n");
+    fprintf(stderr,"  -l   list the programs in a container\n");
+    fprintf(stderr,"  -x   unpack the programs in a container\n");
+    return(1);
+  }
+
+  if (argv[1][1] == 'c') {
+    if (argc < 4) {
+      fprintf(stderr,"mzt: no tape files to pack\n");
+      return(1);
+    }
+    return(pack(argv[2],argc-3,&argv[3]));
+  }
+
+  for (int argn=2;argn<argc;argn++)
+    failed+=unpack(argv[argn],argv[1][1]=='x');
+
+  return(failed ? 1 : 0);
+}
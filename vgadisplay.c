@@ -2,13 +2,20 @@
 /* Tim Holyoake, August-October 2024  */
 
 #include "picomz.h"
+#include "mzglyph.h"
 
 #define VGA_MODE vga_mode_320x240_60    // This gives us a 40x30 display,
                                         // so we use the first 40x25 for the
                                         // Sharp MZ-80K.
+#define VGA_HIRES vga_mode_640x480_60   // Optional 640x480 mode - each pixel
+                                        // is doubled horizontally and each
+                                        // scanline is repeated by scanvideo.
 #define VGA_WIDTH VGA_MODE.width
 #define VGA_LINES 240
 #define MIN_RUN 3
+#define VGA_LINE_HZ 31469                // 640x480@60 scanline frequency
+#define RTBINS 8                         // Render time histogram bins, each
+                                         // 1/8th of a scanline period
 
 // MZ-80K display buffer (VRAM) is 40 chars x 25 lines
 #define DWIDTH          40
@@ -17,68 +24,215 @@
 #define CHEIGHT         8      // ... and 8 pixels tall
 #define DLASTLINE       (DLINES * CHEIGHT) // Last scanline of MZ-80K
 
-// On the MZ-80K, pixels are either white or black
-uint16_t whitepix=PICO_SCANVIDEO_PIXEL_FROM_RGB8(255,255,255);
-uint16_t blackpix=PICO_SCANVIDEO_PIXEL_FROM_RGB8(0,0,0);
+// Palettes - the MZ-80K display and the emulator status area each have
+// their own palette, chosen from the colour themes in mzglyph.h
+#define NPALETTES       2      // PALDISPLAY and PALSTATUS (picomz.h)
 
-/* Generate each pixel for the current scanline */
-int32_t gen_scanline(uint32_t *buf, size_t buf_length, int lineNum)
+static uint8_t mztheme[NPALETTES]={0,0};// Theme used by each palette
+static bool mzreverse=false;            // Reverse video (F5)
+
+// 640x480 pixel doubled output. Set at build time by defining VGA640X480,
+// or at boot time by placing VGA640.CFG in the root of the sd card.
+#ifdef VGA640X480
+  bool vgahires=true;
+#else
+  bool vgahires=false;
+#endif
+
+// Frame consistent VRAM. When vgalatch is set, core 1 copies the visible
+// VRAM at the start of each frame and renders the whole frame from that
+// copy, so writes by core 0 part way through a frame can't tear. The
+// cursor blink state seen by the MZ-80K is latched at the same time.
+// Set at build time by defining VRAMLATCH, toggled at run time by F6.
+#ifdef VRAMLATCH
+  volatile bool vgalatch=true;
+#else
+  volatile bool vgalatch=false;
+#endif
+volatile uint8_t cblinklatch=0;         // Cursor blink latched with VRAM
+static uint8_t vramlatch[DWIDTH*DLINES];// Copy of the 1000 visible bytes
+static const uint8_t *vramsrc=mzvram;   // VRAM used for the current frame
+
+// Scanline render times, measured on core 1 in processor clock cycles
+// between scanvideo_begin_scanline_generation() returning and
+// scanvideo_end_scanline_generation() completing. The final histogram
+// bin counts late scanlines (those that took more than a scanline period).
+static uint32_t rthist[RTBINS+1];       // Render time histogram
+static uint32_t rtmax;                  // Longest render time (cycles)
+static uint32_t rtdropped;              // Frames scanvideo skipped all
+                                        // or some scanlines of
+static uint32_t rtlinesdropped;         // Scanlines skipped by scanvideo
+static uint32_t rtlinecycles;           // Cycles in one generated scanline
+                                        // period - two VGA lines
+
+// Frame count and /VBLANK, published by core 1 for rd8255() on core 0
+vgaframe mzframe={0,0,1};
+
+// Pixel lookup tables, one set per palette. Each 4 bit nibble of a
+// character ROM row is expanded to pixel words (two 16 bit pixels per 32
+// bit word) in one step. The 640 wide table holds every pixel twice.
+// Rebuilt on core 1 at the start of a frame whenever a palette changes,
+// so changing colours costs nothing per pixel.
+static uint32_t pixlut[NPALETTES][16][2];   // 4 pixels per nibble
+static uint32_t pixlut2x[NPALETTES][16][4]; // 8 pixels per nibble (640)
+static volatile bool lutdirty=true;         // Lookup tables need rebuilding
+
+/* Rebuild the pixel lookup tables from the current palettes */
+static void build_pixlut(void)
+{
+  const uint8_t (*rgb)[3];
+  uint16_t fg,bg;
+
+  // Cleared before the settings are read, so a change made on core 0
+  // while the tables are being rebuilt is picked up at the next frame
+  lutdirty=false;
+  __dmb();
+
+  for (uint8_t pal=0;pal<NPALETTES;pal++) {
+    rgb=mzgthemes[mztheme[pal]];
+    fg=PICO_SCANVIDEO_PIXEL_FROM_RGB8(rgb[0][0],rgb[0][1],rgb[0][2]);
+    bg=PICO_SCANVIDEO_PIXEL_FROM_RGB8(rgb[1][0],rgb[1][1],rgb[1][2]);
+    if (mzreverse) {
+      mzglyph_lut(pixlut[pal],bg,fg);
+      mzglyph_lut2x(pixlut2x[pal],bg,fg);
+    }
+    else {
+      mzglyph_lut(pixlut[pal],fg,bg);
+      mzglyph_lut2x(pixlut2x[pal],fg,bg);
+    }
+  }
+
+  return;
+}
+
+/* Swap the foreground and background pixels - reverse video */
+void mzreversevideo(void)
+{
+  mzreverse=!mzreverse;
+  __dmb();                              // New setting before the flag
+  lutdirty=true;                        // Core 1 rebuilds at next frame
+
+  return;
+}
+
+/* Find the RGB8 foreground and background colours of a palette, */
+/* allowing for reverse video                                     */
+void mzpalettergb(uint8_t pal, const uint8_t **fg, const uint8_t **bg)
+{
+  const uint8_t (*rgb)[3]=mzgthemes[mztheme[pal%NPALETTES]];
+
+  *fg=rgb[mzreverse?1:0];
+  *bg=rgb[mzreverse?0:1];
+
+  return;
+}
+
+/* Move the display (0) or status area (1) palette to the next theme */
+void mznexttheme(uint8_t pal)
+{
+  if (pal >= NPALETTES) return;
+
+  if ((++mztheme[pal]) >= MZGTHEMES)
+    mztheme[pal]=0;
+  __dmb();                              // New setting before the flag
+  lutdirty=true;                        // Core 1 rebuilds at next frame
+
+  return;
+}
+
+/* Publish the /VBLANK state (and start of a new frame) to core 0 */
+static void __not_in_flash_func(publish_frame)(uint8_t vblank, bool newframe)
+{
+  mzframe.seq++;                     // Odd - update in progress
+  __dmb();
+  if (newframe) mzframe.count++;
+  mzframe.vblank=vblank;
+  __dmb();
+  mzframe.seq++;                     // Even - update complete
+
+  return;
+}
+
+/* Read the /VBLANK state and, optionally, the frame count on core 0 */
+uint8_t __not_in_flash_func(mzvblank)(uint32_t *frame)
+{
+  uint32_t seq,count;
+  uint8_t vblank;
+
+  do {
+    seq=mzframe.seq;
+    __dmb();
+    count=mzframe.count;
+    vblank=mzframe.vblank;
+    __dmb();
+  } while ((seq&1) || (seq != mzframe.seq));
+
+  if (frame) *frame=count;
+  return(vblank);
+}
+
+/* Generate a scanline from a row of 40 MZ-80K display codes */
+static int32_t __not_in_flash_func(gen_textline)(uint32_t *buf,
+                                                 const uint8_t *chars,
+                                                 int cpixrow, uint8_t pal)
 {
   uint16_t *pixels = (uint16_t *) buf;
-  int vramrow = lineNum/CHEIGHT;     // Find the row of the VRAM we're using
-  int cpixrow = lineNum%CHEIGHT;     // Find the pixel row in the character
-                                     // ROM we need
+  uint32_t *words = buf+1;           // First pixel pair lives at pixels[2]
+  const uint8_t *cgrow = cgrom+cpixrow;
+  uint16_t npix;                     // Number of pixels in the raw run
+
   // Now work through the display columns to generate the correct scanline
-  pixels += 1;
-  for (uint8_t colidx=0;colidx<DWIDTH;colidx++) {
-    uint8_t charbits = cgrom[mzvram[vramrow*DWIDTH+colidx]*CWIDTH+cpixrow];
-    *(++pixels) = (charbits & 0x80) ? whitepix : blackpix;
-    *(++pixels) = (charbits & 0x40) ? whitepix : blackpix;
-    *(++pixels) = (charbits & 0x20) ? whitepix : blackpix;
-    *(++pixels) = (charbits & 0x10) ? whitepix : blackpix;
-    *(++pixels) = (charbits & 0x08) ? whitepix : blackpix;
-    *(++pixels) = (charbits & 0x04) ? whitepix : blackpix;
-    *(++pixels) = (charbits & 0x02) ? whitepix : blackpix;
-    *(++pixels) = (charbits & 0x01) ? whitepix : blackpix;
+  if (vgahires) {
+    mzglyph_row2x(words,chars,cgrow,pixlut2x[pal]);
+    npix = DWIDTH*CWIDTH*2;
+  }
+  else {
+    mzglyph_row(words,chars,cgrow,pixlut[pal]);
+    npix = DWIDTH*CWIDTH;
   }
-  *(++pixels) = 0;
-  *(++pixels) = COMPOSABLE_EOL_ALIGN;
-  pixels = (uint16_t *) buf;
+  pixels[npix+2] = 0;
+  pixels[npix+3] = COMPOSABLE_EOL_ALIGN;
   pixels[0] = COMPOSABLE_RAW_RUN;
   pixels[1] = pixels[2];
-  pixels[2] = DWIDTH*CWIDTH-2;
+  pixels[2] = npix-2;
+
+  // 640 wide lines fill most of the scanline buffer, so only send what
+  // has actually been generated (run header, pixels, black, EOL).
+  return (vgahires ? (npix+4)/2 : DWIDTH*CWIDTH-4);
+}
+
+/* Generate a blank scanline as a single solid colour run. Used while */
+/* /VGATE is active, so costs far less than a normal scanline.        */
+static int32_t __not_in_flash_func(gen_blankline)(uint32_t *buf)
+{
+  uint16_t *pixels = (uint16_t *) buf;
+
+  pixels[0] = COMPOSABLE_COLOR_RUN;
+  pixels[1] = 0;                     // Blanked display is always black
+  pixels[2] = (vgahires ? DWIDTH*CWIDTH*2 : DWIDTH*CWIDTH)-3;
+  pixels[3] = COMPOSABLE_RAW_1P;
+  pixels[4] = 0;
+  pixels[5] = COMPOSABLE_EOL_ALIGN;
 
-  return (DWIDTH*CWIDTH-4);
+  return(3);
+}
+
+/* Generate each pixel for the current scanline */
+int32_t gen_scanline(uint32_t *buf, size_t buf_length, int lineNum)
+{
+  int vramrow = lineNum/CHEIGHT;     // Find the row of the VRAM we're using
+  int cpixrow = lineNum%CHEIGHT;     // Find the pixel row in the character
+                                     // ROM we need
+  return(gen_textline(buf,&vramsrc[vramrow*DWIDTH],cpixrow,PALDISPLAY));
 }
 
 /* The bottom 40 scanlines are used for emulator status messages */
 int32_t gen_last40_scanlines(uint32_t *buf, size_t buf_len, int lineNum)
 {
-  uint16_t *pixels = (uint16_t *) buf;
   int emusrow = (lineNum-DLASTLINE)/CHEIGHT;  // Find row of the emulator status
   int cpixrow = (lineNum-DLASTLINE)%CHEIGHT;  // Find pixel row in the character
                                               // ROM we need
-  // Now work through the display columns to generate the correct scanline
-  pixels += 1;
-  for (uint8_t colidx=0;colidx<DWIDTH;colidx++) {
-    uint8_t charbits = cgrom[mzemustatus[emusrow*DWIDTH+colidx]*CWIDTH+cpixrow];
-    *(++pixels) = (charbits & 0x80) ? whitepix : blackpix;
-    *(++pixels) = (charbits & 0x40) ? whitepix : blackpix;
-    *(++pixels) = (charbits & 0x20) ? whitepix : blackpix;
-    *(++pixels) = (charbits & 0x10) ? whitepix : blackpix;
-    *(++pixels) = (charbits & 0x08) ? whitepix : blackpix;
-    *(++pixels) = (charbits & 0x04) ? whitepix : blackpix;
-    *(++pixels) = (charbits & 0x02) ? whitepix : blackpix;
-    *(++pixels) = (charbits & 0x01) ? whitepix : blackpix;
-  }
-  *(++pixels) = 0;
-  *(++pixels) = COMPOSABLE_EOL_ALIGN;
-  pixels = (uint16_t *) buf;
-  pixels[0] = COMPOSABLE_RAW_RUN;
-  pixels[1] = pixels[2];
-  pixels[2] = DWIDTH*CWIDTH-2;
-
-  return (DWIDTH*CWIDTH-4);
+  return(gen_textline(buf,&mzemustatus[emusrow*DWIDTH],cpixrow,PALSTATUS));
 }
 
 /* Output the composed scanline to the display */
@@ -87,15 +241,31 @@ void render_scanline(struct scanvideo_scanline_buffer *dest, int core)
   uint32_t *buf = dest->data;
   size_t buf_length = dest->data_max;
   int lineNum = scanvideo_scanline_number(dest->scanline_id);
+  bool blank = vgate;                // Sample /VGATE once per scanline
 
   /* If we're beyond the last scanline of the MZ-80K display,
-     output the emulator status area. Toggle vblank as required */
-  if (lineNum == 0) vblank = 0;
-  if (lineNum >= DLASTLINE)  { 
+     output the emulator status area. /VBLANK is active from the end of
+     the 200 line MZ-80K display until the start of the next frame, as
+     on the real machine (the status area counts as blanking time) */
+  if (lineNum == 0) {
+    publish_frame(0,true);
+    if (lutdirty) build_pixlut();  // Colours changed - new lookup tables
+    if (vgalatch) {                // Latch VRAM and cursor blink state
+      memcpy(vramlatch,mzvram,DWIDTH*DLINES);
+      cblinklatch=cblink;
+      vramsrc=vramlatch;
+    }
+    else
+      vramsrc=mzvram;
+  }
+  if (lineNum >= DLASTLINE)  {
+    if (lineNum == DLASTLINE) publish_frame(1,false);
     dest->data_used = gen_last40_scanlines(buf, buf_length, lineNum);
-    if (lineNum == VGA_LINES-1) vblank = 1; 
   }
-  else { 
+  else if (blank) {
+      dest->data_used = gen_blankline(buf);
+  }
+  else {
       dest->data_used = gen_scanline(buf, buf_length, lineNum);
   }
 
@@ -103,22 +273,126 @@ void render_scanline(struct scanvideo_scanline_buffer *dest, int core)
   return;
 }
 
+/* Record the time taken to render one scanline and check for drops */
+static void __not_in_flash_func(record_rendertime)(uint32_t cycles,
+                                                   uint32_t scanline_id)
+{
+  static uint16_t prevframe;
+  static int prevline=-1;            // No scanline seen yet
+  static bool lost=false;            // Current frame has lost scanlines
+  uint16_t frame=scanvideo_frame_number(scanline_id);
+  int line=scanvideo_scanline_number(scanline_id);
+  uint16_t frames;
+  int32_t missed;
+  uint32_t bin;
+
+  bin=(cycles*RTBINS)/rtlinecycles;
+  if (bin > RTBINS) bin=RTBINS;      // Late - missed the line deadline
+  ++rthist[bin];
+  if (cycles > rtmax) rtmax=cycles;
+
+  // scanvideo skips scanlines, and whole frames, that it could not get
+  // in time. The frame and line numbers together give the scanlines
+  // missed since the last one, and each frame that lost any of them is
+  // counted once - a whole frame skipped leaves the line numbers in step.
+  if (prevline >= 0) {
+    frames=frame-prevframe;          // Frame numbers are 16 bit
+    missed=(int32_t)frames*VGA_LINES+line-prevline-1;
+    if (missed > 0) {
+      rtlinesdropped+=missed;
+      if (frames == 0) {             // Part way through this frame
+        if (!lost) ++rtdropped;
+        lost=true;
+      }
+      else {
+        if ((prevline < VGA_LINES-1) && !lost)
+          ++rtdropped;               // End of the last frame
+        rtdropped+=frames-1;         // Frames skipped whole
+        lost=(line > 0);             // Start of this frame
+        if (lost) ++rtdropped;
+      }
+    }
+    else if (frames > 0)
+      lost=false;
+  }
+  prevframe=frame;
+  prevline=line;
+
+  return;
+}
+
+/* Show the scanline render statistics on status line 4 (and via USB) */
+void mzrenderstats(void)
+{
+  uint8_t spos=EMULINE4;
+  uint8_t mzstr[12];            // Longest label is "Render max:"
+  uint32_t late=rthist[RTBINS];
+  uint32_t dropped=rtdropped;
+  uint32_t maxpc=(rtmax*100)/rtlinecycles;
+
+#ifdef USBDIAGOUTPUT
+  uint32_t total=0;
+  for (uint8_t i=0;i<=RTBINS;i++)
+    total+=rthist[i];
+  SHOW("Scanline render times (%d cycles per scanline)\n",rtlinecycles);
+  for (uint8_t i=0;i<RTBINS;i++)
+    SHOW("  %3d%% - %3d%% : %d\n",(i*100)/RTBINS,((i+1)*100)/RTBINS,
+                                    rthist[i]);
+  SHOW("  late        : %d of %d\n",late,total);
+  SHOW("  longest %d cycles (%d%%), %d frames dropped (%d scanlines)\n",
+       rtmax,maxpc,dropped,rtlinesdropped);
+#endif
+
+  // Keep the numbers short enough to fit on one 40 character line
+  if (maxpc > 999) maxpc=999;
+  if (late > 99999) late=99999;
+  if (dropped > 99999) dropped=99999;
+
+  memset(mzemustatus+EMULINE4,0x00,40); // Blank line
+  ascii2mzdisplay("Render max:",mzstr);
+  for (uint8_t i=0;i<11;i++)
+    mzemustatus[spos++]=mzstr[i];
+  spos+=mznum2mzdisplay(maxpc,mzemustatus+spos);
+  ascii2mzdisplay("% late:",mzstr);
+  for (uint8_t i=0;i<7;i++)
+    mzemustatus[spos++]=mzstr[i];
+  spos+=mznum2mzdisplay(late,mzemustatus+spos);
+  ascii2mzdisplay(" drop:",mzstr);
+  for (uint8_t i=0;i<6;i++)
+    mzemustatus[spos++]=mzstr[i];
+  mznum2mzdisplay(dropped,mzemustatus+spos);
+
+  return;
+}
+
 /* Prepare the next scanline and send it for display on core 1 */
 void render_loop(void)
 {
   int core_num = get_core_num();
+  uint32_t start,id;
+
+  // Core 1's SysTick counts down from 2^24 at the processor clock rate
+  systick_hw->rvr = 0x00FFFFFF;
+  systick_hw->cvr = 0;
+  systick_hw->csr = 0x5;
+  // Each generated scanline is sent twice (yscale 2 in both modes), so
+  // it has two VGA line periods to be rendered in
+  rtlinecycles = 2*clock_get_hz(clk_sys)/VGA_LINE_HZ;
 
   for(;;) {
 
     // Start a new buffer
     struct scanvideo_scanline_buffer *sb=
       scanvideo_begin_scanline_generation(true);
+    start=systick_hw->cvr;
+    id=sb->scanline_id;              // sb is scanvideo's again once sent
 
     // Fill this buffer with content
     render_scanline(sb, core_num);
 
     // Send the buffer for display
     scanvideo_end_scanline_generation(sb);
+    record_rendertime((start-systick_hw->cvr)&0x00FFFFFF,id);
   }
 
   return;
@@ -127,7 +401,21 @@ void render_loop(void)
 /* Initialise the VGA code and render forever on core 1*/
 void vga_main(void)
 {
-  scanvideo_setup(&VGA_MODE);
+  static scanvideo_mode_t hiresmode;
+
+  build_pixlut();
+
+  if (vgahires) {
+    // Same 240 line frame as the standard mode, but 640 pixels wide.
+    // scanvideo sends each generated scanline twice (yscale 2), so the
+    // rendering cost per frame is unchanged apart from the wider line.
+    hiresmode=VGA_HIRES;
+    hiresmode.height=VGA_LINES;
+    hiresmode.yscale=2;
+    scanvideo_setup(&hiresmode);
+  }
+  else
+    scanvideo_setup(&VGA_MODE);
   scanvideo_timing_enable(true);
 
   render_loop();  // Core 1 never returns from here